@@ -0,0 +1,272 @@
+// Throughput benchmark of CCargoPlanner, built by "make bench" (solution.cpp with -DPLANNER_BENCH).
+// Usage: ./bench [ships] [customers] [sellers] [workers]
+//
+// The same workload is run with different thread placements:
+//   unpinned    - no affinity, the scheduler is free to migrate the threads,
+//   node-local  - sellers and workers spread over all NUMA nodes, orders are solved on the node
+//                 of the seller that completed them,
+//   cross-node  - sellers pinned to node 0, workers to node 1, every order crosses the interconnect.
+// On a single-node machine the last two scenarios degrade to pinned runs on node 0.
+//
+// The second part solves the same workload with ProgtestSolver and with the parallel
+// branch and bound solver (CCargoPlanner::SetParallelSolver), each once with CShipTest, which
+// copies the load, and once with CShipMoveTest, which takes it by move (CShipMoveLoad).
+//
+// The third part submits a burst of ships much faster than one worker can load them, once
+// without a limit and once with admission control (CCargoPlanner::SetAdmission), and reports
+// the peak number of orders held by the planner.
+//
+// The last part ships repeatedly to a few destinations, each served by only two of the
+// customers, and reports how many Quote calls the negative-quote index saves, also with the
+// index limited to fewer destinations than there are.
+#ifndef PLANNER_BENCH_H_4358912374561827345
+#define PLANNER_BENCH_H_4358912374561827345
+
+// CShipTest that opts in to CShipMoveLoad. The moved load is handed to CShipTest only by
+// Validate, after the timed run, so the sample tester's check stays the one in use. A copying
+// Load is counted and fails the validation, the planner must have taken the move path.
+class CShipMoveTest : public CShipTest, public CShipMoveLoad
+{
+  public:
+                             CShipMoveTest                 ( const CShipTest & ship )
+      : CShipTest ( ship )
+    {
+    }
+    //---------------------------------------------------------------------------------------------
+    virtual void             Load                          ( const std::vector<CCargo>  & cargo ) override
+    {
+      m_Copies ++;
+      CShipTest::Load ( cargo );
+    }
+    //---------------------------------------------------------------------------------------------
+    virtual void             LoadMove                      ( std::vector<CCargo>  && cargo ) override
+    {
+      m_Moved = move ( cargo );
+    }
+    //---------------------------------------------------------------------------------------------
+    bool                     Validate                      ( void )
+    {
+      if ( m_Copies )
+        return false;
+      CShipTest::Load ( m_Moved );
+      return CShipTest::Validate ();
+    }
+  private:
+    int                      m_Copies = 0;
+    std::vector<CCargo>      m_Moved;
+};
+
+struct CBenchPlacement
+{
+  const char             * m_Name;
+  std::vector<int>         m_Sellers;
+  std::vector<int>         m_Workers;
+};
+
+static double      runPlannerBench                         ( const CBenchPlacement & placement,
+                                                             int               nShips,
+                                                             int               nCustomers,
+                                                             int               sellers,
+                                                             int               workers,
+                                                             bool              parallel,
+                                                             bool              moveLoad,
+                                                             int             & failed )
+{
+  CCargoPlanner  planner;
+  vector<AShipTest> ships;
+  vector<shared_ptr<CShipMoveTest>> moveShips;
+  vector<ACustomerTest> customers;
+
+  srand ( 12345 );
+  for ( int i = 0; i < nCustomers; i ++ )
+    customers . push_back ( make_shared<CCustomerTest> () );
+  for ( int i = 0; i < nShips; i ++ )
+  {
+    AShipTest ship = g_TestExtra[i % g_TestExtra . size ()] . PrepareTest ( "dest" + to_string ( i ), customers );
+    if ( moveLoad )
+    {
+      moveShips . push_back ( make_shared<CShipMoveTest> ( *ship ) );
+      ship = moveShips . back ();
+    }
+    ships . push_back ( ship );
+  }
+  for ( auto x : customers )
+    planner . Customer ( x );
+
+  planner . SetAffinity ( placement . m_Sellers, placement . m_Workers );
+  planner . SetParallelSolver ( parallel );
+  auto start = chrono::steady_clock::now ();
+  planner . Start ( sellers, workers );
+  for ( auto x : ships )
+    planner . Ship ( x );
+  planner . Stop ();
+  auto end = chrono::steady_clock::now ();
+
+  failed = 0;
+  for ( int i = 0; i < nShips; i ++ )
+    if ( moveLoad ? ! moveShips[i] -> Validate () : ! ships[i] -> Validate () )
+      failed ++;
+  return chrono::duration<double> ( end - start ) . count ();
+}
+
+static double      runQuoteBench                           ( int               missThreshold,
+                                                             int               probeInterval,
+                                                             size_t            maxDestinations,
+                                                             int               nDestinations,
+                                                             int               rounds,
+                                                             int               nCustomers,
+                                                             QuoteStats      & stats,
+                                                             int             & failed )
+{
+  CCargoPlanner  planner;
+  vector<AShipTest> ships;
+  vector<ACustomerTest> customers;
+  vector<ACustomerTest> scratch { make_shared<CCustomerTest> () };
+
+  srand ( 12345 );
+  for ( int i = 0; i < nCustomers; i ++ )
+    customers . push_back ( make_shared<CCustomerTest> () );
+  for ( int r = 0; r < rounds; r ++ )
+    for ( int d = 0; d < nDestinations; d ++ )
+    {
+      const CSampleData & data = g_TestExtra[d % g_TestExtra . size ()];
+      vector<ACustomerTest> served { customers[( 2 * d ) % nCustomers], customers[( 2 * d + 1 ) % nCustomers] };
+      // the cargo is registered in the first round only, later ships just carry the expected fee
+      ships . push_back ( data . PrepareTest ( "dest" + to_string ( d ), r ? scratch : served ) );
+    }
+  for ( auto x : customers )
+    planner . Customer ( x );
+
+  planner . SetNegativeQuotePolicy ( missThreshold, probeInterval, maxDestinations );
+  auto start = chrono::steady_clock::now ();
+  planner . Start ( 2, 2 );
+  for ( size_t i = 0; i < ships . size (); i ++ )
+  {
+    // let the previous round finish quoting so that the index has something to learn from
+    if ( i && i % nDestinations == 0 )
+      this_thread::sleep_for ( chrono::milliseconds ( 20 ) );
+    planner . Ship ( ships[i] );
+  }
+  planner . Stop ();
+  auto end = chrono::steady_clock::now ();
+
+  stats = planner . GetQuoteStats ();
+  failed = 0;
+  for ( auto x : ships )
+    if ( ! x -> Validate () )
+      failed ++;
+  return chrono::duration<double> ( end - start ) . count ();
+}
+
+static double      runOverloadBench                        ( size_t            maxInFlight,
+                                                             int               nShips,
+                                                             QueueStats      & stats,
+                                                             int             & failed )
+{
+  CCargoPlanner  planner;
+  vector<AShipTest> ships;
+  vector<ACustomerTest> customers;
+
+  srand ( 12345 );
+  for ( int i = 0; i < 4; i ++ )
+    customers . push_back ( make_shared<CCustomerTest> () );
+  for ( int i = 0; i < nShips; i ++ )
+    ships . push_back ( g_TestExtra[i % g_TestExtra . size ()] . PrepareTest ( "dest" + to_string ( i ), customers ) );
+  for ( auto x : customers )
+    planner . Customer ( x );
+
+  planner . SetAdmission ( maxInFlight );
+  auto start = chrono::steady_clock::now ();
+  planner . Start ( 2, 1 );
+  for ( auto x : ships )
+    planner . Ship ( x );
+  planner . Stop ();
+  auto end = chrono::steady_clock::now ();
+
+  stats = planner . GetQueueStats ();
+  failed = 0;
+  for ( auto x : ships )
+    if ( ! x -> Validate () )
+      failed ++;
+  return chrono::duration<double> ( end - start ) . count ();
+}
+
+int                main                                    ( int               argc,
+                                                             char            * argv [] )
+{
+  int nShips     = argc > 1 ? atoi ( argv[1] ) : 400;
+  int nCustomers = argc > 2 ? atoi ( argv[2] ) : 8;
+  int sellers    = argc > 3 ? atoi ( argv[3] ) : 4;
+  int workers    = argc > 4 ? atoi ( argv[4] ) : 4;
+
+  const CpuTopology & topology = CpuTopology::get ();
+  const vector<int> & node0 = topology . cpusOfNode ( 0 );
+  const vector<int> & node1 = topology . nodes () > 1 ? topology . cpusOfNode ( 1 ) : node0;
+  vector<int> all;
+  // interleave the nodes so that both groups get cores on every node
+  for ( size_t i = 0; ; i ++ )
+  {
+    bool any = false;
+    for ( int n = 0; n < topology . nodes (); n ++ )
+      if ( i < topology . cpusOfNode ( n ) . size () )
+      {
+        all . push_back ( topology . cpusOfNode ( n )[i] );
+        any = true;
+      }
+    if ( ! any )
+      break;
+  }
+
+  vector<CBenchPlacement> placements
+  {
+    { "unpinned",   {},    {}    },
+    { "node-local", all,   all   },
+    { "cross-node", node0, node1 }
+  };
+
+  printf ( "nodes: %d, ships: %d, customers: %d, sellers: %d, workers: %d\n",
+           topology . nodes (), nShips, nCustomers, sellers, workers );
+  for ( const auto & placement : placements )
+  {
+    int failed;
+    double t = runPlannerBench ( placement, nShips, nCustomers, sellers, workers, false, false, failed );
+    printf ( "%-12s %8.3f s %10.1f ships/s %s\n", placement . m_Name, t, nShips / t,
+             failed ? "(validation failed)" : "" );
+  }
+
+  printf ( "solver:\n" );
+  for ( bool parallel : { false, true } )
+    for ( bool moveLoad : { false, true } )
+    {
+      int failed;
+      double t = runPlannerBench ( placements[0], nShips, nCustomers, sellers, workers, parallel, moveLoad, failed );
+      printf ( "%-8s %-4s %8.3f s %10.1f ships/s %s\n", parallel ? "B&B" : "progtest", moveLoad ? "move" : "copy",
+               t, nShips / t, failed ? "(validation failed)" : "" );
+    }
+
+  printf ( "overload, one worker:\n" );
+  for ( size_t limit : { 0, 8 } )
+  {
+    QueueStats stats;
+    int failed;
+    double t = runOverloadBench ( limit, nShips, stats, failed );
+    printf ( "limit %-6zu %8.3f s  peak in flight %4ld  blocked %4ld  dropped %4ld %s\n", limit, t,
+             stats . peakInFlight, stats . blocked, stats . dropped, failed ? "(validation failed)" : "" );
+  }
+
+  const int nDestinations = 8, rounds = 4, quoteCustomers = 64;
+  printf ( "negative-quote index: destinations: %d, rounds: %d, customers: %d\n", nDestinations, rounds, quoteCustomers );
+  // the last run keeps only half of the destinations in the index
+  for ( auto policy : { make_pair ( 0, 4096 ), make_pair ( 1, 4096 ), make_pair ( 2, 4096 ), make_pair ( 1, nDestinations / 2 ) } )
+  {
+    QuoteStats stats;
+    int failed;
+    double t = runQuoteBench ( policy . first, 8, policy . second, nDestinations, rounds, quoteCustomers, stats, failed );
+    printf ( "threshold %d, %4d destinations %8.3f s  quoted %6ld  skipped %6ld  empty %6ld  evicted %4ld %s\n",
+             policy . first, policy . second, t, stats . quoted, stats . skipped, stats . empty, stats . evicted,
+             failed ? "(validation failed)" : "" );
+  }
+  return 0;
+}
+
+#endif /* PLANNER_BENCH_H_4358912374561827345 */
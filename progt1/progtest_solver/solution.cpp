@@ -37,6 +37,16 @@
 using namespace std;
 #endif /* __PROGTEST__ */
 
+// Opt-in extension of CShip, kept out of common.h (the progtest interface). A ship class that
+// derives from both CShip and this class receives the final load by move, so loading does not
+// copy any cargo item.
+class CShipMoveLoad
+{
+public:
+	virtual ~CShipMoveLoad() = default;
+	virtual void LoadMove(vector<CCargo>&& cargo) = 0;
+};
+
 template <class T> class threadQ
 {
 public:
@@ -45,6 +55,9 @@ public:
 
 	void enqueue(T t);
 	T dequeue();
+	bool dequeueOr(T& t, const function<bool()>& interrupted);
+	void wakeAll();
+	size_t size() const;
 
 private:
 	queue<T> q;
@@ -71,6 +84,34 @@ template <class T> T threadQ<T>::dequeue()
 	return val;
 }
 
+// Like dequeue, but gives up and returns false as soon as interrupted() holds. The predicate is
+// evaluated under the queue lock, whoever makes it true must call wakeAll afterwards.
+template <class T> bool threadQ<T>::dequeueOr(T& t, const function<bool()>& interrupted)
+{
+	unique_lock<mutex> lock(m);
+	while (q.empty())
+	{
+		if (interrupted())
+			return false;
+		c.wait(lock);
+	}
+	t = q.front();
+	q.pop();
+	return true;
+}
+
+template <class T> void threadQ<T>::wakeAll()
+{
+	lock_guard<mutex> lock(m);
+	c.notify_all();
+}
+
+template <class T> size_t threadQ<T>::size() const
+{
+	lock_guard<mutex> lock(m);
+	return q.size();
+}
+
 class Order
 {
 	public:
@@ -85,10 +126,15 @@ class Order
 		void setShip(AShip s);
 		void addCargo(CCargo c);
 		vector<CCargo>& getCargo();
+		void partitionLoad(const vector<char>& chosen);
+		size_t getLoaded() const;
+		vector<CCargo> takeLoad();
 		mutable mutex m;
 
 	private:
+		// after partitionLoad, cargo[0, loaded) is the load and the rest stays ashore
 		vector<CCargo> cargo;
+		size_t loaded;
 		AShip ship;
 		int orderNumber;
 		int nCustomers;
@@ -98,6 +144,7 @@ class Order
 Order::Order()
 {
 	nCustomersServed = 0;
+	loaded = 0;
 }
 
 const int Order::getCustomersServed() const
@@ -150,27 +197,657 @@ vector<CCargo>& Order::getCargo()
 	return cargo;
 }
 
+// Moves the items with chosen[i] set to the front of cargo, keeping their order.
+void Order::partitionLoad(const vector<char>& chosen)
+{
+	loaded = 0;
+	for (size_t i = 0; i < cargo.size(); i++)
+		if (chosen[i])
+		{
+			if (i != loaded)
+				swap(cargo[i], cargo[loaded]);
+			loaded++;
+		}
+}
+
+size_t Order::getLoaded() const
+{
+	return loaded;
+}
+
+// Hands over the cargo storage, the order must not be used for anything but delete afterwards.
+vector<CCargo> Order::takeLoad()
+{
+	cargo.erase(cargo.begin() + loaded, cargo.end());
+	return move(cargo);
+}
+
+// NUMA topology as exported by Linux: the node ids in /sys/devices/system/node/online (they may
+// have gaps), the cpus of each in /sys/devices/system/node/node<N>/cpulist. Machines without the
+// sysfs tree (or other systems) are treated as a single node 0.
+class CpuTopology
+{
+public:
+	static const CpuTopology& get();
+	int nodeOfCpu(int cpu) const;
+	int nodes() const;
+	const vector<int>& cpusOfNode(int node) const;
+	int distance(int from, int to) const;
+
+private:
+	CpuTopology();
+	static bool parseCpuList(const char* path, vector<int>& cpus);
+
+	vector<int> cpuNode;
+	vector<vector<int>> nodeCpus;
+	// SLIT distances, nodeDistance[from][to], empty where the kernel does not provide them
+	vector<vector<int>> nodeDistance;
+};
+
+CpuTopology::CpuTopology()
+{
+	char path[64];
+	vector<int> online;
+	parseCpuList("/sys/devices/system/node/online", online);
+	for (int node : online)
+	{
+		vector<int> cpus;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		if (!parseCpuList(path, cpus))
+			continue;
+		for (int cpu : cpus)
+		{
+			if (cpu >= (int)cpuNode.size())
+				cpuNode.resize(cpu + 1, 0);
+			cpuNode[cpu] = node;
+		}
+		if (node >= (int)nodeCpus.size())
+			nodeCpus.resize(node + 1);
+		nodeCpus[node] = cpus;
+	}
+	// one distance per online node, in the order of node/online
+	nodeDistance.resize(nodeCpus.size());
+	for (int node : online)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/distance", node);
+		FILE* f = fopen(path, "r");
+		if (!f)
+			continue;
+		vector<int> row(nodeCpus.size(), -1);
+		int d;
+		for (size_t i = 0; i < online.size() && fscanf(f, "%d", &d) == 1; i++)
+			if (online[i] < (int)row.size())
+				row[online[i]] = d;
+		fclose(f);
+		if (node < (int)nodeDistance.size())
+			nodeDistance[node] = row;
+	}
+	if (nodeCpus.empty())
+	{
+		nodeCpus.resize(1);
+		for (unsigned int cpu = 0; cpu < max(1u, thread::hardware_concurrency()); cpu++)
+			nodeCpus[0].push_back(cpu);
+	}
+}
+
+// also the format of the node list
+bool CpuTopology::parseCpuList(const char* path, vector<int>& cpus)
+{
+	FILE* f = fopen(path, "r");
+	if (!f)
+		return false;
+	// format: "0-3,8-11,16"
+	int from, to;
+	char sep;
+	while (fscanf(f, "%d", &from) == 1)
+	{
+		to = from;
+		if (fscanf(f, "%c", &sep) == 1 && sep == '-')
+		{
+			if (fscanf(f, "%d", &to) != 1)
+				break;
+			if (fscanf(f, "%c", &sep) != 1)
+				sep = '\n';
+		}
+		for (int cpu = from; cpu <= to; cpu++)
+			cpus.push_back(cpu);
+		if (sep != ',')
+			break;
+	}
+	fclose(f);
+	return true;
+}
+
+const CpuTopology& CpuTopology::get()
+{
+	static CpuTopology topology;
+	return topology;
+}
+
+int CpuTopology::nodeOfCpu(int cpu) const
+{
+	if (cpu < 0 || cpu >= (int)cpuNode.size())
+		return 0;
+	return cpuNode[cpu];
+}
+
+int CpuTopology::nodes() const
+{
+	return nodeCpus.size();
+}
+
+const vector<int>& CpuTopology::cpusOfNode(int node) const
+{
+	static const vector<int> none;
+	if (node < 0 || node >= (int)nodeCpus.size())
+		return none;
+	return nodeCpus[node];
+}
+
+// Relative distance as in node/nodeN/distance (10 = local). Without the table, 10 to itself and
+// 20 to any other node.
+int CpuTopology::distance(int from, int to) const
+{
+	if (from >= 0 && from < (int)nodeDistance.size() && to >= 0 && to < (int)nodeDistance[from].size()
+		&& nodeDistance[from][to] >= 0)
+		return nodeDistance[from][to];
+	return from == to ? 10 : 20;
+}
+
+// pins the calling thread, before it allocates or dequeues anything
+bool pinThread(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+// cpu < 0 = unpinned. A thread that cannot be pinned runs unpinned and stays with the node of cpu,
+// a worker is the consumer of that node's queue.
+void pinOrWarn(int cpu)
+{
+	if (cpu >= 0 && !pinThread(cpu))
+		fprintf(stderr, "CCargoPlanner: cannot pin a thread to cpu %d, it runs unpinned\n", cpu);
+}
+
+// Exact solver of the two-constraint (weight, volume) knapsack by branch and bound. The search
+// is split into subtrees on the fly: whenever the shared pool runs low, a thread donates the
+// "skip this item" branch of its current node. Any thread may join a running solve with work(),
+// the best fee found so far is an atomic every thread prunes against immediately. The upper
+// bound is the minimum of three surrogate relaxations (weight/volume normalized, weight only,
+// volume only), each solved as a fractional knapsack over the undecided items.
+class ParallelKnapsack
+{
+public:
+	ParallelKnapsack(const vector<CCargo>& cargo, int maxWeight, int maxVolume);
+	void work(bool owner);
+	bool needsHelp() const;
+	size_t size() const;
+	int bestFee() const;
+	void chosen(vector<char>& mask) const;
+	void onWork(function<void()> callback);
+
+private:
+	struct Item
+	{
+		int fee;
+		int weight;
+		int volume;
+		int index;
+	};
+	struct Node
+	{
+		int depth;
+		int fee;
+		int weight;
+		int volume;
+		vector<char> taken;
+	};
+	static const int SURROGATES = 3;
+	static const int DONATE_BELOW = 4;
+	static const int MIN_SPLIT_DEPTH = 8;
+
+	void explore(Node& node, vector<char>& taken);
+	void dfs(int depth, int fee, int weight, int volume, vector<char>& taken);
+	double bound(int depth, int fee, int weight, int volume) const;
+	void improve(int fee, int depth, const vector<char>& taken);
+	void donate(int depth, int fee, int weight, int volume, const vector<char>& taken);
+
+	vector<Item> items;
+	size_t nCargo;
+	int maxWeight;
+	int maxVolume;
+	// per surrogate: multipliers and the items (as positions in items) by decreasing fee density
+	double mulWeight[SURROGATES];
+	double mulVolume[SURROGATES];
+	vector<int> order[SURROGATES];
+
+	atomic<int> best;
+	mutable mutex bestMutex;
+	vector<char> bestTaken;
+
+	mutable mutex poolMutex;
+	condition_variable poolCond;
+	vector<Node> pool;
+	atomic<int> poolSize;
+	int active;
+	function<void()> workCallback;
+};
+
+ParallelKnapsack::ParallelKnapsack(const vector<CCargo>& cargo, int maxWeight, int maxVolume)
+	: nCargo(cargo.size()), maxWeight(maxWeight), maxVolume(maxVolume), best(0), poolSize(0), active(0)
+{
+	for (size_t i = 0; i < cargo.size(); i++)
+		if (cargo[i].m_Fee > 0 && cargo[i].m_Weight <= maxWeight && cargo[i].m_Volume <= maxVolume)
+			items.push_back(Item{cargo[i].m_Fee, cargo[i].m_Weight, cargo[i].m_Volume, (int)i});
+
+	mulWeight[0] = maxWeight > 0 ? 1.0 / maxWeight : 0;
+	mulVolume[0] = maxVolume > 0 ? 1.0 / maxVolume : 0;
+	mulWeight[1] = 1;
+	mulVolume[1] = 0;
+	mulWeight[2] = 0;
+	mulVolume[2] = 1;
+	auto byDensity = [this](int s)
+	{
+		return [this, s](const Item& a, const Item& b)
+		{
+			double sa = mulWeight[s] * a.weight + mulVolume[s] * a.volume;
+			double sb = mulWeight[s] * b.weight + mulVolume[s] * b.volume;
+			return a.fee * sb > b.fee * sa;
+		};
+	};
+	// branching follows the normalized surrogate, its own bound order is then the identity
+	stable_sort(items.begin(), items.end(), byDensity(0));
+	for (int s = 0; s < SURROGATES; s++)
+	{
+		order[s].resize(items.size());
+		iota(order[s].begin(), order[s].end(), 0);
+		auto cmp = byDensity(s);
+		stable_sort(order[s].begin(), order[s].end(), [&](int a, int b) { return cmp(items[a], items[b]); });
+	}
+
+	// greedy incumbent
+	vector<char> taken(items.size(), 0);
+	int fee = 0, weight = 0, volume = 0;
+	for (size_t i = 0; i < items.size(); i++)
+		if (weight + items[i].weight <= maxWeight && volume + items[i].volume <= maxVolume)
+		{
+			taken[i] = 1;
+			fee += items[i].fee;
+			weight += items[i].weight;
+			volume += items[i].volume;
+		}
+	best = fee;
+	bestTaken = taken;
+
+	pool.push_back(Node{0, 0, 0, 0, vector<char>()});
+	poolSize = 1;
+}
+
+void ParallelKnapsack::onWork(function<void()> callback)
+{
+	workCallback = move(callback);
+}
+
+// Explores subtrees from the pool. Helpers return as soon as the pool is empty, the owner stays
+// until the whole tree has been searched.
+void ParallelKnapsack::work(bool owner)
+{
+	vector<char> taken(items.size());
+	unique_lock<mutex> lock(poolMutex);
+	while (true)
+	{
+		if (pool.empty())
+		{
+			if (!owner)
+				return;
+			if (active == 0)
+				return;
+			poolCond.wait(lock);
+			continue;
+		}
+		Node node = move(pool.back());
+		pool.pop_back();
+		poolSize--;
+		active++;
+		lock.unlock();
+		explore(node, taken);
+		lock.lock();
+		if (--active == 0 && pool.empty())
+			poolCond.notify_all();
+	}
+}
+
+bool ParallelKnapsack::needsHelp() const
+{
+	return poolSize.load(memory_order_relaxed) > 0;
+}
+
+size_t ParallelKnapsack::size() const
+{
+	return items.size();
+}
+
+int ParallelKnapsack::bestFee() const
+{
+	return best;
+}
+
+// Selection over the original cargo list passed to the constructor.
+void ParallelKnapsack::chosen(vector<char>& mask) const
+{
+	lock_guard<mutex> lock(bestMutex);
+	mask.assign(nCargo, 0);
+	for (size_t i = 0; i < items.size(); i++)
+		if (bestTaken[i])
+			mask[items[i].index] = 1;
+}
+
+void ParallelKnapsack::explore(Node& node, vector<char>& taken)
+{
+	copy(node.taken.begin(), node.taken.end(), taken.begin());
+	dfs(node.depth, node.fee, node.weight, node.volume, taken);
+}
+
+void ParallelKnapsack::dfs(int depth, int fee, int weight, int volume, vector<char>& taken)
+{
+	if (depth == (int)items.size())
+	{
+		if (fee > best.load(memory_order_relaxed))
+			improve(fee, depth, taken);
+		return;
+	}
+	if (bound(depth, fee, weight, volume) < best.load(memory_order_relaxed) + 1 - 1e-9)
+		return;
+
+	const Item& item = items[depth];
+	if (poolSize.load(memory_order_relaxed) < DONATE_BELOW && (int)items.size() - depth > MIN_SPLIT_DEPTH)
+		donate(depth + 1, fee, weight, volume, taken);
+	else
+	{
+		taken[depth] = 0;
+		dfs(depth + 1, fee, weight, volume, taken);
+	}
+	if (weight + item.weight <= maxWeight && volume + item.volume <= maxVolume)
+	{
+		taken[depth] = 1;
+		dfs(depth + 1, fee + item.fee, weight + item.weight, volume + item.volume, taken);
+		taken[depth] = 0;
+	}
+}
+
+double ParallelKnapsack::bound(int depth, int fee, int weight, int volume) const
+{
+	int freeWeight = maxWeight - weight;
+	int freeVolume = maxVolume - volume;
+	double res = DBL_MAX;
+	for (int s = 0; s < SURROGATES; s++)
+	{
+		double capacity = mulWeight[s] * freeWeight + mulVolume[s] * freeVolume;
+		double sum = fee;
+		for (int pos : order[s])
+		{
+			const Item& item = items[pos];
+			// decided items and the ones that do not fit on their own cannot be added
+			if (pos < depth || item.weight > freeWeight || item.volume > freeVolume)
+				continue;
+			double need = mulWeight[s] * item.weight + mulVolume[s] * item.volume;
+			if (need <= capacity)
+			{
+				capacity -= need;
+				sum += item.fee;
+			}
+			else
+			{
+				sum += item.fee * capacity / need;
+				break;
+			}
+			if (sum >= res)
+				break;
+		}
+		res = min(res, sum);
+	}
+	return res;
+}
+
+void ParallelKnapsack::improve(int fee, int depth, const vector<char>& taken)
+{
+	int current = best.load();
+	while (fee > current && !best.compare_exchange_weak(current, fee))
+		;
+	lock_guard<mutex> lock(bestMutex);
+	// a concurrent, better solution may have overtaken this one in between
+	if (best.load() != fee)
+		return;
+	bestTaken.assign(taken.begin(), taken.begin() + depth);
+	bestTaken.resize(items.size(), 0);
+}
+
+void ParallelKnapsack::donate(int depth, int fee, int weight, int volume, const vector<char>& taken)
+{
+	bool wasEmpty;
+	{
+		lock_guard<mutex> lock(poolMutex);
+		wasEmpty = pool.empty();
+		pool.push_back(Node{depth, fee, weight, volume, vector<char>(taken.begin(), taken.begin() + depth)});
+		pool.back().taken[depth - 1] = 0;
+		poolSize++;
+	}
+	poolCond.notify_one();
+	if (wasEmpty && workCallback)
+		workCallback();
+}
+
+struct QuoteStats
+{
+	long quoted;
+	long skipped;
+	long empty;
+	long evicted;	// destinations dropped from the index to keep it within its limit
+};
+
+// Per-destination index of customers that recently quoted nothing, see
+// CCargoPlanner::SetNegativeQuotePolicy. Customers are identified by address. At most
+// maxDestinations destinations are kept, the least recently shipped to goes first.
+class NegativeQuoteIndex
+{
+public:
+	void configure(int missThreshold, int probeInterval, size_t maxDestinations);
+	bool shouldQuote(const string& destination, const CCustomer* customer);
+	void record(const string& destination, const CCustomer* customer, bool empty);
+	QuoteStats stats() const;
+
+private:
+	struct Entry
+	{
+		int misses = 0;
+		int skipped = 0;
+	};
+	struct Destination
+	{
+		unordered_map<const CCustomer*, Entry> customers;
+		list<string>::iterator recent;
+	};
+
+	void touch(Destination& dest);
+
+	mutable mutex m;
+	unordered_map<string, Destination> index;
+	// most recently used destination first
+	list<string> recent;
+	int missThreshold = 0;
+	int probeInterval = 0;
+	size_t maxDestinations = 0;
+	atomic<long> nQuoted{0};
+	atomic<long> nSkipped{0};
+	atomic<long> nEmpty{0};
+	atomic<long> nEvicted{0};
+};
+
+void NegativeQuoteIndex::configure(int missThreshold, int probeInterval, size_t maxDestinations)
+{
+	lock_guard<mutex> lock(m);
+	this->missThreshold = missThreshold;
+	this->probeInterval = probeInterval;
+	this->maxDestinations = max<size_t>(1, maxDestinations);
+	index.clear();
+	recent.clear();
+}
+
+void NegativeQuoteIndex::touch(Destination& dest)
+{
+	recent.splice(recent.begin(), recent, dest.recent);
+}
+
+bool NegativeQuoteIndex::shouldQuote(const string& destination, const CCustomer* customer)
+{
+	{
+		lock_guard<mutex> lock(m);
+		if (missThreshold > 0)
+		{
+			auto dest = index.find(destination);
+			if (dest != index.end())
+			{
+				touch(dest->second);
+				auto it = dest->second.customers.find(customer);
+				if (it != dest->second.customers.end() && it->second.misses >= missThreshold)
+				{
+					// stale entries are probed once every probeInterval ships, 0 never probes again
+					if (probeInterval <= 0 || ++it->second.skipped <= probeInterval)
+					{
+						nSkipped++;
+						return false;
+					}
+					it->second.skipped = 0;
+				}
+			}
+		}
+	}
+	nQuoted++;
+	return true;
+}
+
+void NegativeQuoteIndex::record(const string& destination, const CCustomer* customer, bool empty)
+{
+	if (empty)
+		nEmpty++;
+	lock_guard<mutex> lock(m);
+	if (missThreshold <= 0)
+		return;
+	auto dest = index.find(destination);
+	if (!empty)
+	{
+		// a destination nobody is skipped for any more leaves the index
+		if (dest != index.end() && dest->second.customers.erase(customer) && dest->second.customers.empty())
+		{
+			recent.erase(dest->second.recent);
+			index.erase(dest);
+		}
+		return;
+	}
+	if (dest == index.end())
+	{
+		if (index.size() >= maxDestinations)
+		{
+			index.erase(recent.back());
+			recent.pop_back();
+			nEvicted++;
+		}
+		recent.push_front(destination);
+		dest = index.emplace(destination, Destination()).first;
+		dest->second.recent = recent.begin();
+	}
+	else
+		touch(dest->second);
+	dest->second.customers[customer].misses++;
+}
+
+QuoteStats NegativeQuoteIndex::stats() const
+{
+	return QuoteStats{nQuoted, nSkipped, nEmpty, nEvicted};
+}
+
+enum class ShipResult
+{
+	Accepted,
+	Overloaded,	// the limit of orders in flight is reached, see CCargoPlanner::SetAdmission
+	Stopped		// the planner has been stopped
+};
+
+struct QueueStats
+{
+	long inFlight;		// orders accepted and not loaded yet
+	long peakInFlight;
+	long ordersQueued;	// (order, customer) pairs waiting for a seller
+	long workQueued;	// orders waiting for a worker
+	long rejected;		// TryShip calls refused
+	long blocked;		// Ship calls that had to wait for a free slot
+	long dropped;		// Ship calls after Stop, or waiting for a slot when Stop came
+};
+
 class CCargoPlanner
 {
 private:
 	vector<ACustomer> customers;
 	vector<thread*> sellerThreads;
 	vector<thread*> workerThreads;
+	vector<int> sellerCpus;
+	vector<int> workerCpus;
+	// node -> index into workQueues, the queue of the nearest node that runs workers
+	vector<int> nodeQueue;
+	NegativeQuoteIndex negativeQuotes;
+	bool parallelSolver = false;
+	mutable mutex solvesMutex;
+	vector<shared_ptr<ParallelKnapsack>> solves;
+
+	mutable mutex admissionMutex;
+	condition_variable admissionCond;
+	size_t maxInFlight = 0;
+	size_t inFlight = 0;
+	size_t peakInFlight = 0;
+	long rejected = 0;
+	long blocked = 0;
+	long dropped = 0;
+	bool started = false;
+	bool stopped = false;
+
+	int cpuFor(const vector<int>& cpus, int i) const;
+	ShipResult admit(bool wait);
+	void submit(AShip ship);
 
 public:
-	threadQ<Order*> workQueue;
+	vector<unique_ptr<threadQ<Order*>>> workQueues;
 	threadQ<pair<Order*,ACustomer>> ordersQueue;
 
 	static int SeqSolver(const vector<CCargo>& cargo, int maxWeight, int maxVolume, vector<CCargo>& load);
+	int ParSolver(const vector<CCargo>& cargo, int maxWeight, int maxVolume, vector<char>& chosen);
+	bool solveNeedsHelp() const;
+	void helpSolve();
+	void SetParallelSolver(bool enabled);
+	bool ParallelSolver() const;
+	void SetAffinity(const vector<int>& sellers, const vector<int>& workers);
+	void SetNegativeQuotePolicy(int missThreshold, int probeInterval, size_t maxDestinations = 4096);
+	QuoteStats GetQuoteStats() const;
+	void QuoteDone(Order* order, const CCustomer* customer, bool empty);
+	threadQ<Order*>& workQueueOf(int node);
 	void Start(int sales, int workers);
 	void Stop(void);
 	void Customer(ACustomer customer);
 	void Ship(AShip ship);
+	ShipResult TryShip(AShip ship);
+	void SetAdmission(size_t maxInFlight);
+	QueueStats GetQueueStats() const;
+	void OrderDone();
 
 };
 
-void sellerThread(CCargoPlanner* planner);
-void workThread(CCargoPlanner* planner);
+void sellerThread(CCargoPlanner* planner, int node);
+void workThread(CCargoPlanner* planner, int node);
 
 int CCargoPlanner::SeqSolver(const vector<CCargo>& cargo, int maxWeight, int maxVolume, vector<CCargo>& load)
 {
@@ -178,16 +855,173 @@ int CCargoPlanner::SeqSolver(const vector<CCargo>& cargo, int maxWeight, int max
 	return res;
 }
 
+// Solves with ParallelKnapsack, registered so that idle workers can join the search.
+int CCargoPlanner::ParSolver(const vector<CCargo>& cargo, int maxWeight, int maxVolume, vector<char>& chosen)
+{
+	auto solve = make_shared<ParallelKnapsack>(cargo, maxWeight, maxVolume);
+	solve->onWork([this]()
+	{
+		for (auto& queue : workQueues)
+			queue->wakeAll();
+	});
+	{
+		lock_guard<mutex> lock(solvesMutex);
+		solves.push_back(solve);
+	}
+	solve->work(true);
+	{
+		lock_guard<mutex> lock(solvesMutex);
+		solves.erase(find(solves.begin(), solves.end(), solve));
+	}
+	solve->chosen(chosen);
+	return solve->bestFee();
+}
+
+bool CCargoPlanner::solveNeedsHelp() const
+{
+	lock_guard<mutex> lock(solvesMutex);
+	for (auto& solve : solves)
+		if (solve->needsHelp())
+			return true;
+	return false;
+}
+
+// Joins the largest running solve that has subtrees to give away.
+void CCargoPlanner::helpSolve()
+{
+	shared_ptr<ParallelKnapsack> largest;
+	{
+		lock_guard<mutex> lock(solvesMutex);
+		for (auto& solve : solves)
+			if (solve->needsHelp() && (!largest || solve->size() > largest->size()))
+				largest = solve;
+	}
+	if (largest)
+		largest->work(false);
+}
+
+// Optional, must be called before Start. Workers solve with ParallelKnapsack instead of
+// ProgtestSolver, and a worker with an empty queue helps with the largest running solve.
+void CCargoPlanner::SetParallelSolver(bool enabled)
+{
+	parallelSolver = enabled;
+}
+
+bool CCargoPlanner::ParallelSolver() const
+{
+	return parallelSolver;
+}
+
+// Optional, must be called before Start. Thread i of a group runs on cpus[i % cpus.size()],
+// an empty list leaves the group unpinned. Orders completed by a seller are solved by workers
+// on the seller's NUMA node whenever that node runs any.
+void CCargoPlanner::SetAffinity(const vector<int>& sellers, const vector<int>& workers)
+{
+	sellerCpus = sellers;
+	workerCpus = workers;
+}
+
+// Optional, off by default. A customer that answered an empty quote for a destination
+// missThreshold times in a row is skipped by further ships to that destination and only
+// re-probed once every probeInterval ships (probeInterval 0 skips it for good).
+// Any non-empty answer drops the customer from the index again. The index keeps at most
+// maxDestinations destinations, the least recently shipped to is forgotten first.
+void CCargoPlanner::SetNegativeQuotePolicy(int missThreshold, int probeInterval, size_t maxDestinations)
+{
+	negativeQuotes.configure(missThreshold, probeInterval, maxDestinations);
+}
+
+QuoteStats CCargoPlanner::GetQuoteStats() const
+{
+	return negativeQuotes.stats();
+}
+
+void CCargoPlanner::QuoteDone(Order* order, const CCustomer* customer, bool empty)
+{
+	negativeQuotes.record(order->getShip()->Destination(), customer, empty);
+}
+
+int CCargoPlanner::cpuFor(const vector<int>& cpus, int i) const
+{
+	if (cpus.empty())
+		return -1;
+	return cpus[i % cpus.size()];
+}
+
+threadQ<Order*>& CCargoPlanner::workQueueOf(int node)
+{
+	if (node < 0 || node >= (int)nodeQueue.size())
+		node = 0;
+	return *workQueues[nodeQueue[node]];
+}
+
 void CCargoPlanner::Start(int sales, int workers)
 {
+	const CpuTopology& topology = CpuTopology::get();
+	vector<int> workerNode(workers);
+	nodeQueue.assign(topology.nodes(), -1);
+	for (int i = 0; i < workers; i++)
+	{
+		int cpu = cpuFor(workerCpus, i);
+		workerNode[i] = cpu < 0 ? 0 : topology.nodeOfCpu(cpu);
+		if (nodeQueue[workerNode[i]] < 0)
+		{
+			nodeQueue[workerNode[i]] = workQueues.size();
+			workQueues.emplace_back(new threadQ<Order*>());
+		}
+	}
+	if (workQueues.empty())
+		workQueues.emplace_back(new threadQ<Order*>());
+	{
+		lock_guard<mutex> lock(admissionMutex);
+		started = true;
+	}
+	// nodes without workers hand their orders to the nearest node that has some, the next node id
+	// of those at the same distance
+	vector<int> ownQueue = nodeQueue;
+	for (int node = 0; node < (int)nodeQueue.size(); node++)
+	{
+		if (ownQueue[node] >= 0)
+			continue;
+		int best = -1;
+		for (int next = 1; next < (int)nodeQueue.size(); next++)
+		{
+			int other = (node + next) % nodeQueue.size();
+			if (ownQueue[other] >= 0 && (best < 0 || topology.distance(node, other) < topology.distance(node, best)))
+				best = other;
+		}
+		nodeQueue[node] = best < 0 ? 0 : ownQueue[best];
+	}
+
 	for (int i = 0; i < sales; i++)
-		sellerThreads.push_back(new thread(sellerThread, this));
+	{
+		int cpu = cpuFor(sellerCpus, i);
+		int node = cpu < 0 ? 0 : topology.nodeOfCpu(cpu);
+		sellerThreads.push_back(new thread([this, cpu, node]()
+		{
+			pinOrWarn(cpu);
+			sellerThread(this, node);
+		}));
+	}
 	for (int i = 0; i < workers; i++)
-		workerThreads.push_back(new thread(workThread, this));
+	{
+		int cpu = cpuFor(workerCpus, i);
+		int node = workerNode[i];
+		workerThreads.push_back(new thread([this, cpu, node]()
+		{
+			pinOrWarn(cpu);
+			workThread(this, node);
+		}));
+	}
 }
 
 void CCargoPlanner::Stop()
 {
+	{
+		lock_guard<mutex> lock(admissionMutex);
+		stopped = true;
+		admissionCond.notify_all();
+	}
 	for (unsigned int i = 0; i < sellerThreads.size(); i++)
 	{
 		Order* nullOrder = nullOrder;
@@ -199,7 +1033,10 @@ void CCargoPlanner::Stop()
 		delete seller;
 	}
 	for (unsigned int i = 0; i < workerThreads.size(); i++)
-		workQueue.enqueue(nullptr);
+	{
+		int cpu = cpuFor(workerCpus, i);
+		workQueueOf(cpu < 0 ? 0 : CpuTopology::get().nodeOfCpu(cpu)).enqueue(nullptr);
+	}
 	for (auto& worker : workerThreads)
 	{
 		worker->join();
@@ -212,22 +1049,111 @@ void CCargoPlanner::Customer(ACustomer customer)
 	customers.push_back(customer);
 }
 
+// Optional admission control, at most maxInFlight orders are accepted and not loaded yet at any
+// time (0, the default, means unlimited). Ship() waits for a free slot, TryShip() rejects instead.
+// Before Start nobody would free a slot, Ship() accepts over the limit then. A Ship() still waiting
+// when Stop comes (or called after Stop) drops its ship, QueueStats::dropped counts them.
+void CCargoPlanner::SetAdmission(size_t maxInFlight)
+{
+	lock_guard<mutex> lock(admissionMutex);
+	this->maxInFlight = maxInFlight;
+	admissionCond.notify_all();
+}
+
+ShipResult CCargoPlanner::admit(bool wait)
+{
+	unique_lock<mutex> lock(admissionMutex);
+	bool waited = false;
+	while (started && !stopped && maxInFlight && inFlight >= maxInFlight && wait)
+	{
+		waited = true;
+		admissionCond.wait(lock);
+	}
+	if (waited)
+		blocked++;
+	if (stopped)
+	{
+		(wait ? dropped : rejected)++;
+		return ShipResult::Stopped;
+	}
+	// a Ship before Start goes over the limit
+	if (!wait && maxInFlight && inFlight >= maxInFlight)
+	{
+		rejected++;
+		return ShipResult::Overloaded;
+	}
+	inFlight++;
+	peakInFlight = max(peakInFlight, inFlight);
+	return ShipResult::Accepted;
+}
+
+void CCargoPlanner::OrderDone()
+{
+	lock_guard<mutex> lock(admissionMutex);
+	inFlight--;
+	admissionCond.notify_one();
+}
+
+QueueStats CCargoPlanner::GetQueueStats() const
+{
+	QueueStats stats;
+	{
+		lock_guard<mutex> lock(admissionMutex);
+		stats.inFlight = inFlight;
+		stats.peakInFlight = peakInFlight;
+		stats.rejected = rejected;
+		stats.blocked = blocked;
+		stats.dropped = dropped;
+	}
+	stats.ordersQueued = ordersQueue.size();
+	stats.workQueued = 0;
+	for (auto& queue : workQueues)
+		stats.workQueued += queue->size();
+	return stats;
+}
+
+// Blocks while the planner is full (once started), a ship passed after Stop is dropped.
 void CCargoPlanner::Ship(AShip ship)
+{
+	if (admit(true) == ShipResult::Accepted)
+		submit(ship);
+}
+
+ShipResult CCargoPlanner::TryShip(AShip ship)
+{
+	ShipResult res = admit(false);
+	if (res == ShipResult::Accepted)
+		submit(ship);
+	return res;
+}
+
+void CCargoPlanner::submit(AShip ship)
 {
 	Order* order = new Order();
 	order->setShip(ship);
-	order->setCustomers(customers.size());
-	for (ACustomer customer : customers)
+	vector<ACustomer> quoted;
+	for (ACustomer& customer : customers)
+		if (negativeQuotes.shouldQuote(ship->Destination(), customer.get()))
+			quoted.push_back(customer);
+	// an order nobody is asked to quote passes the sellers with a null customer
+	if (quoted.empty())
+		quoted.push_back(nullptr);
+	order->setCustomers(quoted.size());
+	for (ACustomer& customer : quoted)
 		ordersQueue.enqueue(make_pair(order,customer));
 }
 
-void sellerThread(CCargoPlanner* planner)
+void sellerThread(CCargoPlanner* planner, int node)
 {
 	pair<Order*,ACustomer> orderCustomer;
 	while ((orderCustomer = planner->ordersQueue.dequeue()).first)
 	{
 		vector<CCargo> tmpCargo;
-		orderCustomer.second->Quote(orderCustomer.first->getShip()->Destination(), tmpCargo);
+		if (orderCustomer.second)
+		{
+			orderCustomer.second->Quote(orderCustomer.first->getShip()->Destination(), tmpCargo);
+			planner->QuoteDone(orderCustomer.first, orderCustomer.second.get(), tmpCargo.empty());
+		}
 		bool isLast = false;
 		{
 			lock_guard<mutex> lock(orderCustomer.first->m);
@@ -237,25 +1163,56 @@ void sellerThread(CCargoPlanner* planner)
 			isLast = orderCustomer.first->getCustomersServed() == orderCustomer.first->getCustomers();
 		}
 		if (isLast)
-			planner->workQueue.enqueue(orderCustomer.first);
+			planner->workQueueOf(node).enqueue(orderCustomer.first);
 	}
 }
 
-void workThread(CCargoPlanner* planner)
+void workThread(CCargoPlanner* planner, int node)
 {
 	Order* order;
-	while ((order = planner->workQueue.dequeue()))
+	// scratch buffers reused by all orders of this worker, a load moved into a ship starts over empty
+	vector<CCargo> load;
+	vector<char> chosen;
+	while (true)
 	{
-		vector<CCargo> load;
+		if (!planner->workQueueOf(node).dequeueOr(order, [planner]() { return planner->solveNeedsHelp(); }))
+		{
+			planner->helpSolve();
+			continue;
+		}
+		if (!order)
+			break;
+		CShipMoveLoad* moveLoad = dynamic_cast<CShipMoveLoad*>(order->getShip().get());
+		if (planner->ParallelSolver())
+		{
+			planner->ParSolver(order->getCargo(), order->getShip()->MaxWeight(), order->getShip()->MaxVolume(), chosen);
+			order->partitionLoad(chosen);
+			if (moveLoad)
+				moveLoad->LoadMove(order->takeLoad());
+			else
+				order->getShip()->Load(order->takeLoad());
+			delete order;
+			planner->OrderDone();
+			continue;
+		}
+		load.clear();
 		CCargoPlanner::SeqSolver(order->getCargo(), order->getShip()->MaxWeight(), order->getShip()->MaxVolume(), load);
-		order->getShip()->Load(load);
+		// ProgtestSolver returns its own copy of the load, that copy is handed over as it is
+		if (moveLoad)
+			moveLoad->LoadMove(move(load));
+		else
+			order->getShip()->Load(load);
 		delete order;
+		planner->OrderDone();
 	}
 }
 
 // TODO: CCargoPlanner implementation goes here
 //-------------------------------------------------------------------------------------------------
 #ifndef __PROGTEST__
+#ifdef PLANNER_BENCH
+#include "planner_bench.h"
+#else
 int                main                                    ( void )
 {
   CCargoPlanner  test;
@@ -282,4 +1239,5 @@ int                main                                    ( void )
     cout << x -> Destination () << ": " << ( x -> Validate () ? "ok" : "fail" ) << endl;
   return 0;  
 }
+#endif /* PLANNER_BENCH */
 #endif /* __PROGTEST__ */ 
@@ -0,0 +1,601 @@
+// Address translation throughput, bulk copy speed, SetMemLimit latency (bulk and one page at a time,
+// with the fragmentation statistics of the buddy allocator), NewProcess latency, paging to the swap
+// file, demand-zero fault latency with and without the pre-zeroed page pool, quota admission by
+// concurrent processes, resize latency and page walks with and without 4 MiB large pages, and
+// compaction of fragmented memory, NewProcess latency with and without copyMem, and the allocator
+// throughput of 1 to PROCESS_MAX processes resizing at once, and same-page merging of the copies
+// made by copyMem processes. Built by "make bench" (and
+// "make bench_notlb", the same with the software TLB in CCPU::virtual2Physical disabled),
+// "make benchmark" runs it and keeps the results in bench.json.
+// Usage: ./bench [pages] [rounds] [results-file]
+// The results file gets one JSON object per measurement and line:
+//   {"section":"...","bench":"...","metric":"...","value":...}
+// for comparing runs by a script; the text on the standard output stays as it is.
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <initializer_list>
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.h"
+using namespace std;
+
+struct TBenchArg
+{
+  uint32_t                   m_Pages;
+  uint32_t                   m_Rounds;
+};
+
+static FILE      * g_Results;
+// configuration the following measurements run with, part of each result
+static const char * g_Section = "default";
+
+static void        result                                  ( const char      * bench,
+                                                             const char      * metric,
+                                                             double            value )
+{
+  if ( g_Results )
+    fprintf ( g_Results, "{\"section\":\"%s\",\"bench\":\"%s\",\"metric\":\"%s\",\"value\":%.6g}\n", g_Section,
+              bench, metric, value );
+}
+
+static double      elapsed                                 ( chrono::steady_clock::time_point start )
+{
+  return chrono::duration<double> ( chrono::steady_clock::now () - start ) . count ();
+}
+
+static void        report                                  ( const char      * name,
+                                                             uint64_t          translations,
+                                                             double            t,
+                                                             uint32_t          sum )
+{
+  // the checksum keeps the reads from being optimized out
+  printf ( "%-12s %12llu translations %8.3f s %8.1f M/s (%08x)\n", name, (unsigned long long) translations, t,
+           translations / t / 1e6, sum );
+  result ( name, "M/s", translations / t / 1e6 );
+}
+
+static void        translationBench                        ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  const uint32_t wordsPerPage = CCPU::PAGE_SIZE / 4;
+
+  if ( ! cpu -> SetMemLimit ( a -> m_Pages ) )
+  {
+    printf ( "SetMemLimit ( %u ) failed\n", a -> m_Pages );
+    return;
+  }
+
+  // every word of every page, like rwTest
+  auto start = chrono::steady_clock::now ();
+  uint32_t sum = 0;
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+    for ( uint32_t addr = 0; addr < a -> m_Pages * CCPU::PAGE_SIZE; addr += 4 )
+      cpu -> WriteInt ( addr, addr ^ r );
+  report ( "seq write", (uint64_t) a -> m_Rounds * a -> m_Pages * wordsPerPage, elapsed ( start ), 0 );
+
+  start = chrono::steady_clock::now ();
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+    for ( uint32_t addr = 0; addr < a -> m_Pages * CCPU::PAGE_SIZE; addr += 4 )
+    {
+      uint32_t val;
+      cpu -> ReadInt ( addr, val );
+      sum += val;
+    }
+  report ( "seq read", (uint64_t) a -> m_Rounds * a -> m_Pages * wordsPerPage, elapsed ( start ), sum );
+
+  // one word per page, a new page on every access
+  const uint32_t strideRounds = a -> m_Rounds * wordsPerPage;
+  start = chrono::steady_clock::now ();
+  for ( uint32_t r = 0; r < strideRounds; r ++ )
+    for ( uint32_t page = 0; page < a -> m_Pages; page ++ )
+    {
+      uint32_t val;
+      cpu -> ReadInt ( page * CCPU::PAGE_SIZE + ( r % wordsPerPage ) * 4, val );
+      sum += val;
+    }
+  report ( "page stride", (uint64_t) strideRounds * a -> m_Pages, elapsed ( start ), sum );
+
+  // random words within a working set that fits the TLB
+  const uint32_t hotPages = a -> m_Pages < CCPU::TLB_ENTRIES ? a -> m_Pages : CCPU::TLB_ENTRIES;
+  const uint64_t randomAccesses = (uint64_t) a -> m_Rounds * a -> m_Pages * wordsPerPage;
+  uint32_t seed = 12345;
+  start = chrono::steady_clock::now ();
+  for ( uint64_t i = 0; i < randomAccesses; i ++ )
+  {
+    uint32_t val;
+    seed = seed * 1103515245 + 12345;
+    cpu -> ReadInt ( ( seed >> 8 ) % ( hotPages * CCPU::PAGE_SIZE ) & ~3u, val );
+    sum += val;
+  }
+  report ( "random hot", randomAccesses, elapsed ( start ), sum );
+
+  // bulk copy of the lower half of the memory to the upper half, against a plain memcpy
+  const uint32_t half = a -> m_Pages / 2 * CCPU::PAGE_SIZE;
+  uint8_t * from = new uint8_t [ half ], * to = new uint8_t [ half ];
+  memset ( from, 1, half );
+  start = chrono::steady_clock::now ();
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+    cpu -> CopyBlock ( half, 0, half );
+  double t = elapsed ( start );
+  printf ( "%-12s %12llu bytes        %8.3f s %8.1f MB/s\n", "CopyBlock", (unsigned long long) a -> m_Rounds * half, t,
+           (double) a -> m_Rounds * half / t / 1e6 );
+  result ( "CopyBlock", "MB/s", (double) a -> m_Rounds * half / t / 1e6 );
+  start = chrono::steady_clock::now ();
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+  {
+    memcpy ( to, from, half );
+    from[r] = to[half - 1 - r];
+  }
+  t = elapsed ( start );
+  printf ( "%-12s %12llu bytes        %8.3f s %8.1f MB/s\n", "memcpy", (unsigned long long) a -> m_Rounds * half, t,
+           (double) a -> m_Rounds * half / t / 1e6 );
+  result ( "memcpy", "MB/s", (double) a -> m_Rounds * half / t / 1e6 );
+  delete [] from;
+  delete [] to;
+}
+
+// growing from zero to all pages and shrinking back
+static void        resizeBench                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  double grow = 0, shrink = 0;
+
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+  {
+    auto start = chrono::steady_clock::now ();
+    cpu -> SetMemLimit ( a -> m_Pages );
+    grow += elapsed ( start );
+    start = chrono::steady_clock::now ();
+    cpu -> SetMemLimit ( 0 );
+    shrink += elapsed ( start );
+  }
+  printf ( "%-12s %12u pages        %8.1f us grow %8.1f us shrink\n", "SetMemLimit", a -> m_Pages,
+           grow * 1e6 / a -> m_Rounds, shrink * 1e6 / a -> m_Rounds );
+  result ( "SetMemLimit grow", "us", grow * 1e6 / a -> m_Rounds );
+  result ( "SetMemLimit shrink", "us", shrink * 1e6 / a -> m_Rounds );
+}
+
+static void        fragChild                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  cpu -> SetMemLimit ( (uintptr_t) arg );
+  this_thread::sleep_for ( chrono::milliseconds ( 200 ) );
+}
+
+// growing and shrinking one page at a time, the single-page allocation path
+static void        singlePageBench                         ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  double grow = 0, shrink = 0;
+
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+  {
+    auto start = chrono::steady_clock::now ();
+    for ( uint32_t i = 1; i <= a -> m_Pages; i ++ )
+      cpu -> SetMemLimit ( i );
+    grow += elapsed ( start );
+    start = chrono::steady_clock::now ();
+    for ( uint32_t i = a -> m_Pages; i -- > 0; )
+      cpu -> SetMemLimit ( i );
+    shrink += elapsed ( start );
+  }
+  double n = (double) a -> m_Rounds * a -> m_Pages;
+  printf ( "%-12s %12u pages        %8.3f us grow %8.3f us shrink per page\n", "single page", a -> m_Pages,
+           grow * 1e6 / n, shrink * 1e6 / n );
+  result ( "single page grow", "us/page", grow * 1e6 / n );
+  result ( "single page shrink", "us/page", shrink * 1e6 / n );
+
+  // fragmentation left behind by a few processes of odd sizes
+  for ( uint32_t i = 0; i < 8; i ++ )
+    cpu -> NewProcess ( (void *) (uintptr_t) ( 300 + 77 * i ), fragChild, false );
+  this_thread::sleep_for ( chrono::milliseconds ( 100 ) );
+  TMemMgrFragStats frag = MemMgrFragStats ();
+  printf ( "%-12s %12u free pages   largest block %u, free blocks by order:", "buddy", frag . m_FreePages,
+           frag . m_LargestBlock );
+  for ( uint32_t o = 0; o < 11; o ++ )
+    printf ( " %u", frag . m_FreeBlocks[o] );
+  printf ( "\n" );
+  result ( "buddy", "largest block", frag . m_LargestBlock );
+}
+
+// one word per page, every access misses the TLB and walks the page tables
+static void        walkBench                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  const uint32_t wordsPerPage = CCPU::PAGE_SIZE / 4;
+
+  if ( ! cpu -> SetMemLimit ( a -> m_Pages ) )
+  {
+    printf ( "SetMemLimit ( %u ) failed\n", a -> m_Pages );
+    return;
+  }
+  const uint32_t strideRounds = a -> m_Rounds * wordsPerPage;
+  uint32_t sum = 0;
+  auto start = chrono::steady_clock::now ();
+  for ( uint32_t r = 0; r < strideRounds; r ++ )
+    for ( uint32_t page = 0; page < a -> m_Pages; page ++ )
+    {
+      uint32_t val;
+      cpu -> ReadInt ( page * CCPU::PAGE_SIZE + ( r % wordsPerPage ) * 4, val );
+      sum += val;
+    }
+  report ( "page stride", (uint64_t) strideRounds * a -> m_Pages, elapsed ( start ), sum );
+}
+
+// every other page taken by a one-page segment that is released then, compacted on demand
+static void        compactBench                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  int * segments = new int [ a -> m_Pages ];
+
+  for ( uint32_t i = 0; i < a -> m_Pages; i ++ )
+  {
+    cpu -> SetMemLimit ( i + 1 );
+    segments[i] = cpu -> CreateSegment ( 1 );
+  }
+  for ( uint32_t i = 0; i < a -> m_Pages; i ++ )
+    cpu -> ReleaseSegment ( segments[i] );
+  delete [] segments;
+  uint32_t before = MemMgrFragStats () . m_FreeBlocks[10];
+  auto start = chrono::steady_clock::now ();
+  uint32_t after = MemMgrCompact ();
+  double t = elapsed ( start );
+  uint64_t migrated = MemMgrFragStats () . m_MigratedPages;
+  printf ( "%-12s %12llu pages moved  %8.3f s %8.1f us/page  free large blocks %u -> %u\n", "compaction",
+           (unsigned long long) migrated, t, migrated ? t * 1e6 / migrated : 0.0, before, after );
+  result ( "compaction", "us/page", migrated ? t * 1e6 / migrated : 0.0 );
+  result ( "compaction", "free large blocks", after );
+}
+
+struct TDedupArg
+{
+  uint32_t                   m_Pages;
+  sem_t                      m_Written;
+  sem_t                      m_Release;
+};
+
+static void        dedupChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TDedupArg * a = (TDedupArg *) arg;
+  for ( uint32_t page = 0; page < a -> m_Pages; page ++ )
+    cpu -> WriteInt ( page * CCPU::PAGE_SIZE, page );
+  sem_post ( &a -> m_Written );
+  sem_wait ( &a -> m_Release );
+}
+
+// m_Rounds copyMem children rewrite all m_Pages pages with what they hold already, each
+// ends up with private copies of the parent's pages that are merged again on demand
+static void        dedupBench                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  TDedupArg d;
+  d . m_Pages = a -> m_Pages;
+  sem_init ( &d . m_Written, 0, 0 );
+  sem_init ( &d . m_Release, 0, 0 );
+  cpu -> SetMemLimit ( a -> m_Pages );
+  for ( uint32_t page = 0; page < a -> m_Pages; page ++ )
+    cpu -> WriteInt ( page * CCPU::PAGE_SIZE, page );
+  for ( uint32_t i = 0; i < a -> m_Rounds; i ++ )
+    cpu -> NewProcess ( &d, dedupChild, true );
+  for ( uint32_t i = 0; i < a -> m_Rounds; i ++ )
+    sem_wait ( &d . m_Written );
+  TMemMgrStats before = MemMgrStats ();
+  auto start = chrono::steady_clock::now ();
+  uint32_t merged = MemMgrDedup ();
+  double t = elapsed ( start );
+  TMemMgrStats after = MemMgrStats ();
+  uint64_t scanned = after . m_DedupScanned - before . m_DedupScanned;
+  printf ( "%-12s %12llu pages hashed %8.3f s %8.1f us/page  frames freed %u, used pages %u -> %u\n", "dedup",
+           (unsigned long long) scanned, t, scanned ? t * 1e6 / scanned : 0.0, merged, before . m_UsedPages,
+           after . m_UsedPages );
+  result ( "dedup", "us/page", scanned ? t * 1e6 / scanned : 0.0 );
+  result ( "dedup", "frames freed", merged );
+  for ( uint32_t i = 0; i < a -> m_Rounds; i ++ )
+    sem_post ( &d . m_Release );
+}
+
+static void        spawnChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  sem_post ( (sem_t *) arg );
+}
+
+// NewProcess from the call until the child runs, without copying memory and then copying
+// m_Pages pages copy-on-write
+static void        spawnBench                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  sem_t started;
+  sem_init ( &started, 0, 0 );
+
+  for ( bool copyMem : { false, true } )
+  {
+    if ( copyMem )
+    {
+      cpu -> SetMemLimit ( a -> m_Pages );
+      for ( uint32_t page = 0; page < a -> m_Pages; page ++ )
+        cpu -> WriteInt ( page * CCPU::PAGE_SIZE, page );
+    }
+    const char * name = copyMem ? "NewProcess copyMem" : "NewProcess";
+    auto start = chrono::steady_clock::now ();
+    for ( uint32_t i = 0; i < a -> m_Rounds; i ++ )
+    {
+      cpu -> NewProcess ( &started, spawnChild, copyMem );
+      sem_wait ( &started );
+    }
+    double t = elapsed ( start );
+    printf ( "%-12s %12u processes    %8.3f s %8.1f us/process%s\n", "NewProcess", a -> m_Rounds, t,
+             t * 1e6 / a -> m_Rounds, copyMem ? ", copyMem" : "" );
+    result ( name, "us/process", t * 1e6 / a -> m_Rounds );
+  }
+  sem_destroy ( &started );
+}
+
+static pthread_barrier_t g_AdmissionBarrier;
+
+static void        admissionChild                          ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t rounds = (uintptr_t) arg;
+  pthread_barrier_wait ( &g_AdmissionBarrier );
+  for ( uint32_t i = 0; i < rounds; i ++ )
+    cpu -> SetMemLimit ( i % 2 ? 16 : 0 );
+  cpu -> SetMemLimit ( 0 );
+  pthread_barrier_wait ( &g_AdmissionBarrier );
+}
+
+// SetMemLimit with lazy allocation only reserves the quota, all the processes at once
+static void        admissionBench                          ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  pthread_barrier_init ( &g_AdmissionBarrier, NULL, PROCESS_MAX );
+  for ( uint32_t i = 1; i < PROCESS_MAX; i ++ )
+    cpu -> NewProcess ( (void *) (uintptr_t) a -> m_Rounds, admissionChild, false );
+  // the children are waiting by now, the last one to arrive starts them all
+  this_thread::sleep_for ( chrono::milliseconds ( 100 ) );
+  auto start = chrono::steady_clock::now ();
+  pthread_barrier_wait ( &g_AdmissionBarrier );
+  pthread_barrier_wait ( &g_AdmissionBarrier );
+  double t = elapsed ( start );
+  uint64_t calls = (uint64_t) ( PROCESS_MAX - 1 ) * a -> m_Rounds;
+  printf ( "%-12s %12llu calls        %8.3f s %8.1f M/s, %u processes\n", "admission", (unsigned long long) calls, t,
+           calls / t / 1e6, PROCESS_MAX - 1 );
+  result ( "admission", "M/s", calls / t / 1e6 );
+  pthread_barrier_destroy ( &g_AdmissionBarrier );
+}
+
+// first touch of lazily allocated pages, each one takes a zeroed page (per page, fault-around
+// populates most of them without a fault)
+static void        faultBench                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  double total = 0;
+
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+  {
+    cpu -> SetMemLimit ( a -> m_Pages );
+    auto start = chrono::steady_clock::now ();
+    for ( uint32_t page = 0; page < a -> m_Pages; page ++ )
+      cpu -> WriteInt ( page * CCPU::PAGE_SIZE, page );
+    total += elapsed ( start );
+    cpu -> SetMemLimit ( 0 );
+    // give the pool thread time to catch up, as an idle period between bursts would
+    this_thread::sleep_for ( chrono::milliseconds ( 20 ) );
+  }
+  TMemMgrStats stats = MemMgrStats ();
+  printf ( "%-12s %12llu faults       %8.3f s %8.1f us/fault  %llu page faults, %llu populated ahead\n", "demand-zero",
+           (unsigned long long) a -> m_Rounds * a -> m_Pages, total, total * 1e6 / a -> m_Rounds / a -> m_Pages,
+           (unsigned long long) stats . m_DemandZero, (unsigned long long) stats . m_Prefaulted );
+  result ( "demand-zero", "us/fault", total * 1e6 / a -> m_Rounds / a -> m_Pages );
+}
+
+// working set twice the physical memory: 90 % of the accesses go to a hot quarter of the pages
+static void        swapBench                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TBenchArg * a = (TBenchArg *) arg;
+  const uint32_t hot = a -> m_Pages / 4;
+  const uint32_t accesses = a -> m_Rounds * 100000;
+  uint32_t seed = 12345, sum = 0;
+
+  cpu -> SetMemLimit ( a -> m_Pages );
+  TMemMgrSwapStats before = MemMgrSwapStats ();
+  auto start = chrono::steady_clock::now ();
+  for ( uint32_t i = 0; i < accesses; i ++ )
+  {
+    seed = seed * 1103515245 + 12345;
+    uint32_t page = ( seed >> 8 ) % 10 ? ( seed >> 12 ) % hot : ( seed >> 12 ) % a -> m_Pages;
+    uint32_t addr = page * CCPU::PAGE_SIZE + ( seed & 0xffc );
+    if ( seed & 0x10000 )
+      cpu -> WriteInt ( addr, i );
+    else
+    {
+      uint32_t val;
+      cpu -> ReadInt ( addr, val );
+      sum += val;
+    }
+  }
+  double t = elapsed ( start );
+  TMemMgrSwapStats after = MemMgrSwapStats ();
+  uint64_t misses = after . m_SwapIns - before . m_SwapIns;
+  printf ( "%-12s %12u accesses     %8.3f s %8.1f M/s  hit %6.2f %%  in %llu  out %llu  clean %llu  scanned %llu (%08x)\n",
+           "swap", accesses, t, accesses / t / 1e6, 100.0 * ( accesses - misses ) / accesses,
+           (unsigned long long) misses, (unsigned long long) ( after . m_SwapOuts - before . m_SwapOuts ),
+           (unsigned long long) ( after . m_CleanEvictions - before . m_CleanEvictions ),
+           (unsigned long long) ( after . m_Scanned - before . m_Scanned ), sum );
+  result ( "swap", "M/s", accesses / t / 1e6 );
+  result ( "swap", "hit %", 100.0 * ( accesses - misses ) / accesses );
+}
+
+static pthread_barrier_t g_ScalingBarrier;
+
+static void        scalingWorker                           ( CCPU            * cpu,
+                                                             TBenchArg       * a )
+{
+  for ( uint32_t r = 0; r < a -> m_Rounds; r ++ )
+  {
+    cpu -> SetMemLimit ( a -> m_Pages );
+    cpu -> SetMemLimit ( 0 );
+  }
+}
+
+static void        scalingChild                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  pthread_barrier_wait ( &g_ScalingBarrier );
+  scalingWorker ( cpu, (TBenchArg *) arg );
+  pthread_barrier_wait ( &g_ScalingBarrier );
+}
+
+// n processes (the first one is this one) allocate and free m_Pages pages m_Rounds times at once
+static void        scalingRun                              ( CCPU            * cpu,
+                                                             TBenchArg       * a,
+                                                             uint32_t          n )
+{
+  pthread_barrier_init ( &g_ScalingBarrier, NULL, n );
+  for ( uint32_t i = 1; i < n; i ++ )
+    cpu -> NewProcess ( a, scalingChild, false );
+  this_thread::sleep_for ( chrono::milliseconds ( 50 ) );
+  TMemMgrStats before = MemMgrStats ();
+  auto start = chrono::steady_clock::now ();
+  pthread_barrier_wait ( &g_ScalingBarrier );
+  scalingWorker ( cpu, a );
+  pthread_barrier_wait ( &g_ScalingBarrier );
+  double t = elapsed ( start );
+  TMemMgrStats after = MemMgrStats ();
+  pthread_barrier_destroy ( &g_ScalingBarrier );
+  double pages = 2.0 * n * a -> m_Rounds * a -> m_Pages;
+  uint64_t acquisitions = after . m_LockAcquisitions - before . m_LockAcquisitions;
+  uint64_t contended = after . m_LockContended - before . m_LockContended;
+  char name[32];
+  snprintf ( name, sizeof ( name ), "scaling %u", n );
+  printf ( "%-12s %12.0f pages        %8.3f s %8.1f M pages/s  lock contended %5.2f %%  waited %.3f ms\n", name, pages, t,
+           pages / t / 1e6, acquisitions ? 100.0 * contended / acquisitions : 0.0,
+           ( after . m_LockWaitNs - before . m_LockWaitNs ) / 1e6 );
+  result ( name, "M pages/s", pages / t / 1e6 );
+  result ( name, "lock contended %", acquisitions ? 100.0 * contended / acquisitions : 0.0 );
+}
+
+static void        scalingBench                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  for ( uint32_t n = 1; n <= PROCESS_MAX; n *= 2 )
+    scalingRun ( cpu, (TBenchArg *) arg, n );
+}
+
+int                main                                    ( int               argc,
+                                                             char            * argv [] )
+{
+  const int PAGES = 16 * 1024;
+  TBenchArg arg;
+  arg . m_Pages  = argc > 1 ? atoi ( argv[1] ) : 1024;
+  arg . m_Rounds = argc > 2 ? atoi ( argv[2] ) : 8;
+  if ( argc > 3 && ! ( g_Results = fopen ( argv[3], "w" ) ) )
+  {
+    perror ( argv[3] );
+    return 1;
+  }
+
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  printf ( "pages: %u, rounds: %u\n", arg . m_Pages, arg . m_Rounds );
+  MemMgr ( memAligned, PAGES, &arg, translationBench );
+
+  TBenchArg resizeArg = { PAGES - PAGES / 64, arg . m_Rounds };
+  MemMgr ( memAligned, PAGES, &resizeArg, resizeBench );
+
+  TBenchArg singleArg = { 4096, arg . m_Rounds };
+  MemMgr ( memAligned, PAGES, &singleArg, singlePageBench );
+
+  TBenchArg spawnArg = { arg . m_Pages, 2000 };
+  MemMgr ( memAligned, PAGES, &spawnArg, spawnBench );
+
+  {
+    const int SWAP_MEM = 1024;
+    TMemMgrConfig config = { false, 0, 4 * SWAP_MEM, NULL };
+    TBenchArg swapArg = { 2 * SWAP_MEM, arg . m_Rounds };
+    printf ( "overcommit, %u pages in %u pages of memory\n", swapArg . m_Pages, SWAP_MEM );
+    g_Section = "overcommit";
+    MemMgrSetConfig ( config );
+    MemMgr ( memAligned, SWAP_MEM, &swapArg, swapBench );
+  }
+
+  TBenchArg faultArg = { arg . m_Pages < 512 ? arg . m_Pages : 512, arg . m_Rounds };
+  for ( uint32_t faultAround : { 0, 64 } )
+    for ( uint32_t pool : { 0, 1024 } )
+    {
+      TMemMgrConfig config = { true, pool, 0, NULL, false, false, 0, NULL, faultAround };
+      printf ( "lazy allocation, zero pool: %u pages, fault-around: %u pages\n", pool, faultAround );
+      g_Section = faultAround ? ( pool ? "lazy, zero pool, fault-around" : "lazy, fault-around" )
+                              : ( pool ? "lazy, zero pool" : "lazy" );
+      MemMgrSetConfig ( config );
+      MemMgr ( memAligned, PAGES, &faultArg, faultBench );
+    }
+  TBenchArg admissionArg = { 0, 100000 };
+  TMemMgrConfig admissionConfig = { true, 1024, 0, NULL };
+  g_Section = "lazy, zero pool";
+  MemMgrSetConfig ( admissionConfig );
+  MemMgr ( memAligned, PAGES, &admissionArg, admissionBench );
+
+  TBenchArg walkArg = { 4 * CCPU::PAGE_DIR_ENTRIES, arg . m_Rounds };
+  for ( bool large : { false, true } )
+  {
+    TMemMgrConfig config = { false, 0, 0, NULL, large };
+    printf ( "large pages: %s\n", large ? "on" : "off" );
+    g_Section = large ? "large pages" : "small pages";
+    MemMgrSetConfig ( config );
+    MemMgr ( memAligned, PAGES, &resizeArg, resizeBench );
+    MemMgr ( memAligned, PAGES, &walkArg, walkBench );
+  }
+
+  {
+    // the fragmented pages span the first two 4 MiB blocks, the rest is smaller than a large page
+    const int COMPACT_MEM = 3000;
+    TMemMgrConfig config = { false, 0, 0, NULL, true, true, 0 };
+    TBenchArg compactArg = { 1000, 1 };
+    g_Section = "compaction";
+    MemMgrSetConfig ( config );
+    MemMgr ( memAligned, COMPACT_MEM, &compactArg, compactBench );
+  }
+
+  {
+    TMemMgrConfig config = TMemMgrConfig ();
+    config . m_Dedup = true;
+    TBenchArg dedupArg = { arg . m_Pages, 8 };
+    printf ( "same-page merging, %u processes\n", dedupArg . m_Rounds + 1 );
+    g_Section = "same-page merging";
+    MemMgrSetConfig ( config );
+    MemMgr ( memAligned, PAGES, &dedupArg, dedupBench );
+  }
+
+  // 16 pages go through the per-process page caches, 128 pages through the global lock
+  MemMgrSetConfig ( TMemMgrConfig () );
+  for ( uint32_t pages : { 16, 128 } )
+  {
+    TBenchArg scalingArg = { pages, 2000 };
+    printf ( "allocator scaling, %u pages per resize\n", pages );
+    g_Section = pages == 16 ? "scaling, 16 pages" : "scaling, 128 pages";
+    MemMgr ( memAligned, PAGES, &scalingArg, scalingBench );
+  }
+
+  if ( g_Results )
+    fclose ( g_Results );
+
+  delete [] mem;
+  return 0;
+}
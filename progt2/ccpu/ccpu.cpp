@@ -3,8 +3,10 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 #include "common.h"
 using namespace std;
 #endif /* __PROGTEST__ */
@@ -15,12 +17,34 @@ using namespace std;
 {
   m_MemStart = memStart;
   m_PageTableRoot = pageTableRoot;
+  m_Guard = NULL;
+  m_Pinned = ~0u;
+  m_Trace = NULL;
+  tlbFlush ();
 }
 //-------------------------------------------------------------------------------------------------
+// holds CCPU::m_Guard (if any) for the duration of one access
+class CGuard
+{
+  public:
+                             CGuard                        ( pthread_mutex_t * guard )
+                             : m_Mutex ( guard )
+    {
+      if ( m_Mutex ) pthread_mutex_lock ( m_Mutex );
+    }
+                            ~CGuard                        ( void )
+    {
+      if ( m_Mutex ) pthread_mutex_unlock ( m_Mutex );
+    }
+  private:
+    pthread_mutex_t        * m_Mutex;
+};
+//-------------------------------------------------------------------------------------------------
 bool               CCPU::ReadInt                           ( uint32_t          address,
                                                              uint32_t        & value )
 {
   if ( address & 0x3 ) return false; // not aligned
+  CGuard guard ( m_Guard );
   uint32_t * addr = virtual2Physical ( address, false );
   if ( ! addr ) return false;
   value = *addr;
@@ -31,19 +55,139 @@ bool               CCPU::WriteInt                          ( uint32_t          a
                                                              uint32_t          value )
 {
   if ( address & 0x3 ) return false; // not aligned
+  CGuard guard ( m_Guard );
   uint32_t * addr = virtual2Physical ( address, true );
   if ( ! addr ) return false;
   *addr = value;
   return true;
 }
 //-------------------------------------------------------------------------------------------------
+// bytes from address to the end of its page, at most size
+static inline uint32_t pageChunk                           ( uint32_t          address,
+                                                             uint32_t          size )
+{
+  uint32_t left = CCPU::PAGE_SIZE - ( address & ~CCPU::ADDR_MASK );
+  return size < left ? size : left;
+}
+//-------------------------------------------------------------------------------------------------
+bool               CCPU::ReadBlock                         ( uint32_t          address,
+                                                             void            * data,
+                                                             uint32_t          size )
+{
+  CGuard guard ( m_Guard );
+  uint8_t * dst = (uint8_t *) data;
+  while ( size )
+  {
+    uint32_t chunk = pageChunk ( address, size );
+    uint8_t * addr = (uint8_t *) virtual2Physical ( address, false );
+    if ( ! addr ) return false;
+    memcpy ( dst, addr, chunk );
+    dst += chunk;
+    address += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+//-------------------------------------------------------------------------------------------------
+bool               CCPU::WriteBlock                        ( uint32_t          address,
+                                                             const void      * data,
+                                                             uint32_t          size )
+{
+  CGuard guard ( m_Guard );
+  const uint8_t * src = (const uint8_t *) data;
+  while ( size )
+  {
+    uint32_t chunk = pageChunk ( address, size );
+    uint8_t * addr = (uint8_t *) virtual2Physical ( address, true );
+    if ( ! addr ) return false;
+    memcpy ( addr, src, chunk );
+    src += chunk;
+    address += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+//-------------------------------------------------------------------------------------------------
+bool               CCPU::Fill                              ( uint32_t          address,
+                                                             uint8_t           value,
+                                                             uint32_t          size )
+{
+  CGuard guard ( m_Guard );
+  while ( size )
+  {
+    uint32_t chunk = pageChunk ( address, size );
+    uint8_t * addr = (uint8_t *) virtual2Physical ( address, true );
+    if ( ! addr ) return false;
+    memset ( addr, value, chunk );
+    address += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+//-------------------------------------------------------------------------------------------------
+bool               CCPU::CopyBlock                         ( uint32_t          dst,
+                                                             uint32_t          src,
+                                                             uint32_t          size )
+{
+  CGuard guard ( m_Guard );
+  // an overlapping destination above the source is copied from the end
+  bool backwards = dst > src && dst - src < size;
+  while ( size )
+  {
+    uint32_t chunk, to, from;
+    if ( backwards )
+    {
+      chunk = size;
+      chunk = chunk < ( ( dst + size - 1 ) & ~ADDR_MASK ) + 1 ? chunk : ( ( dst + size - 1 ) & ~ADDR_MASK ) + 1;
+      chunk = chunk < ( ( src + size - 1 ) & ~ADDR_MASK ) + 1 ? chunk : ( ( src + size - 1 ) & ~ADDR_MASK ) + 1;
+      to = dst + size - chunk;
+      from = src + size - chunk;
+    }
+    else
+    {
+      chunk = pageChunk ( src, pageChunk ( dst, size ) );
+      to = dst;
+      from = src;
+      dst += chunk;
+      src += chunk;
+    }
+    // destination first, so that breaking copy-on-write there is seen by the source translation
+    // when both lie in the same page
+    uint8_t * toAddr = (uint8_t *) virtual2Physical ( to, true );
+    if ( ! toAddr ) return false;
+    // a fault on the source must not evict the destination page
+    m_Pinned = to >> OFFSET_BITS;
+    uint8_t * fromAddr = (uint8_t *) virtual2Physical ( from, false );
+    m_Pinned = ~0u;
+    if ( ! fromAddr ) return false;
+    memmove ( toAddr, fromAddr, chunk );
+    size -= chunk;
+  }
+  return true;
+}
+//-------------------------------------------------------------------------------------------------
 uint32_t         * CCPU::virtual2Physical                  ( uint32_t          address,
                                                              bool              write )
 {
+  TTlbEntry & tlb = m_Tlb[(address >> OFFSET_BITS) % TLB_ENTRIES];
+#ifndef CCPU_NO_TLB
+  if ( tlb . m_Frame && tlb . m_Page == address >> OFFSET_BITS && ( ! write || tlb . m_Write ) )
+  {
+    if ( write && ! tlb . m_Dirty )
+    {
+      *tlb . m_Level1 |= BIT_DIRTY;
+      *tlb . m_Level2 |= BIT_DIRTY;
+      tlb . m_Dirty = true;
+    }
+    return (uint32_t *)(tlb . m_Frame + (address & ~ADDR_MASK));
+  }
+#endif /* CCPU_NO_TLB */
+
   const uint32_t reqMask = BIT_PRESENT | BIT_USER | (write ? BIT_WRITE : 0 );
   const uint32_t orMask = BIT_REFERENCED | (write ? BIT_DIRTY : 0);
 
   //printf("Prekladam logickou adresu %d na fyzickou.\n", address);
+  bool fault = false;
 
   while ( 1 )
   {
@@ -52,20 +196,81 @@ uint32_t         * CCPU::virtual2Physical                  ( uint32_t          a
 
     if ( (*level1 & reqMask ) != reqMask )
     {
+      fault = true;
       if ( pageFaultHandler ( address, write ) ) continue;
       return NULL;
     }
+    if ( *level1 & BIT_LARGE )
+    {
+      // 4 MiB page, the TLB still caches 4 KiB translations, both level pointers refer to the directory entry
+     *level1 |= orMask;
+      tlb . m_Page   = address >> OFFSET_BITS;
+      tlb . m_Frame  = m_MemStart + (*level1 & ~ (LARGE_PAGE_SIZE - 1)) + (address & (LARGE_PAGE_SIZE - 1) & ADDR_MASK);
+      tlb . m_Level1 = level1;
+      tlb . m_Level2 = level1;
+      tlb . m_Write  = ( *level1 & BIT_WRITE ) != 0;
+      tlb . m_Dirty  = ( *level1 & BIT_DIRTY ) != 0;
+      if ( m_Trace ) return traceAccess ( tlb, address, write, fault );
+      return (uint32_t *)(tlb . m_Frame + (address & ~ADDR_MASK));
+    }
     uint32_t * level2 = (uint32_t *)(m_MemStart + (*level1 & ADDR_MASK )) + ((address >> OFFSET_BITS) & (PAGE_DIR_ENTRIES - 1));
 
     if ( (*level2 & reqMask ) != reqMask )
     {
+      fault = true;
       if ( pageFaultHandler ( address, write ) ) continue;
       return NULL;
     }
    *level1 |= orMask;
    *level2 |= orMask;
-    return (uint32_t *)(m_MemStart + (*level2 & ADDR_MASK) + (address & ~ADDR_MASK));
+    tlb . m_Page   = address >> OFFSET_BITS;
+    tlb . m_Frame  = m_MemStart + (*level2 & ADDR_MASK);
+    tlb . m_Level1 = level1;
+    tlb . m_Level2 = level2;
+    tlb . m_Write  = ( *level1 & *level2 & BIT_WRITE ) != 0;
+    tlb . m_Dirty  = ( *level1 & *level2 & BIT_DIRTY ) != 0;
+    if ( m_Trace ) return traceAccess ( tlb, address, write, fault );
+    return (uint32_t *)(tlb . m_Frame + (address & ~ADDR_MASK));
   }
 }
 //-------------------------------------------------------------------------------------------------
+// Returns the translation just stored in tlb. A traced CPU keeps no translations in the TLB, so
+// that every access comes here and the TLB hit path needs no check. A full ring makes the CPU
+// wait for the consumer, the trace has no gaps. Kept out of line, the translation stays small.
+__attribute__ (( noinline ))
+uint32_t         * CCPU::traceAccess                       ( TTlbEntry       & tlb,
+                                                             uint32_t          address,
+                                                             bool              write,
+                                                             bool              fault )
+{
+  uint32_t * res = (uint32_t *)(tlb . m_Frame + (address & ~ADDR_MASK));
+  tlb . m_Frame = NULL;
+  uint32_t head = m_Trace -> m_Head;
+  while ( head - __atomic_load_n ( &m_Trace -> m_Tail, __ATOMIC_ACQUIRE ) == m_Trace -> m_Size )
+    sched_yield ();
+  timespec now;
+  clock_gettime ( CLOCK_MONOTONIC, &now );
+  TTraceRecord & rec = m_Trace -> m_Records[head & ( m_Trace -> m_Size - 1 )];
+  rec . m_Time     = now . tv_sec * 1000000000ull + now . tv_nsec;
+  rec . m_Page     = address >> OFFSET_BITS;
+  rec . m_Process  = m_Trace -> m_Process;
+  rec . m_Flags    = ( write ? TRACE_WRITE : 0 ) | ( fault ? TRACE_FAULT : 0 );
+  rec . m_Reserved = 0;
+  __atomic_store_n ( &m_Trace -> m_Head, head + 1, __ATOMIC_RELEASE );
+  return res;
+}
+//-------------------------------------------------------------------------------------------------
+void               CCPU::tlbInvalidate                     ( uint32_t          address )
+{
+  TTlbEntry & tlb = m_Tlb[(address >> OFFSET_BITS) % TLB_ENTRIES];
+  if ( tlb . m_Page == address >> OFFSET_BITS )
+    tlb . m_Frame = NULL;
+}
+//-------------------------------------------------------------------------------------------------
+void               CCPU::tlbFlush                          ( void )
+{
+  for ( uint32_t i = 0; i < TLB_ENTRIES; i ++ )
+    m_Tlb[i] . m_Frame = NULL;
+}
+//-------------------------------------------------------------------------------------------------
 
@@ -3,6 +3,32 @@
 
 const uint32_t     PROCESS_MAX = 64;
 
+// One memory access in the trace file (TMemMgrConfig::m_TraceFile). The file starts with
+// TRACE_MAGIC, the records of each process follow in the order of its accesses.
+struct TTraceRecord
+{
+  uint64_t                   m_Time;                       // ns, CLOCK_MONOTONIC
+  uint32_t                   m_Page;                       // logical page
+  uint16_t                   m_Process;                    // numbered from 0 in the order of creation
+  uint8_t                    m_Flags;                      // TRACE_WRITE, TRACE_FAULT
+  uint8_t                    m_Reserved;
+};
+const char         TRACE_MAGIC[8] = { 'C', 'C', 'P', 'U', 'T', 'R', 'C', '1' };
+const uint8_t      TRACE_WRITE = 0x01;
+// the page fault handler was called for the access
+const uint8_t      TRACE_FAULT = 0x02;
+
+// Single-producer single-consumer ring: the thread of the CPU appends, the memory manager drains.
+// The indices only grow, they are taken modulo m_Size (a power of two).
+struct TTraceRing
+{
+  uint32_t                   m_Head;                       // written by the producer
+  uint32_t                   m_Tail;                       // written by the consumer
+  uint32_t                   m_Size;
+  uint16_t                   m_Process;
+  TTraceRecord             * m_Records;
+};
+
 class CCPU
 {
   public:
@@ -15,6 +41,10 @@ class CCPU
     static const uint32_t    BIT_USER                      = 0x0004;
     static const uint32_t    BIT_REFERENCED                = 0x0020;
     static const uint32_t    BIT_DIRTY                     = 0x0040;
+    // level-1 entry maps a 4 MiB large page directly, its address must be LARGE_PAGE_SIZE aligned
+    static const uint32_t    BIT_LARGE                     = 0x0080;
+    static const uint32_t    LARGE_PAGE_SIZE               = PAGE_SIZE * PAGE_DIR_ENTRIES;
+    static const uint32_t    TLB_ENTRIES                   =                64;
 
                              CCPU                          ( uint8_t         * memStart,
                                                              uint32_t          pageTableRoot );
@@ -26,11 +56,40 @@ class CCPU
     virtual bool             NewProcess                    ( void            * processArg,
                                                              void           (* entryPoint) ( CCPU *, void * ),
                                                              bool              copyMem ) = 0;
+    // Shared memory. CreateSegment allocates zeroed pages and returns the id of the segment
+    // (-1 on failure) with one reference owned by the caller, ReleaseSegment drops it and the id
+    // cannot be mapped any more. Each mapping holds a reference as well, the pages are freed with
+    // the last one. A segment is
+    // mapped at a page-aligned address in 4 MiB regions above the memory limit, SetMemLimit
+    // then cannot grow into them. NewProcess does not copy the mappings.
+    virtual int              CreateSegment                 ( uint32_t          pages ) = 0;
+    virtual bool             ReleaseSegment                ( int               id ) = 0;
+    virtual bool             MapSegment                    ( int               id,
+                                                             uint32_t          address ) = 0;
+    virtual bool             UnmapSegment                  ( uint32_t          address ) = 0;
+    // Sub-quota: this process and the processes it creates (now or later) may commit at most pages
+    // (memory limits, page tables and page directories), 0 = no limit of its own. The limits of
+    // the creators apply as well. False if more is committed already.
+    virtual bool             SetQuota                      ( uint32_t          pages ) = 0;
 
     bool                     ReadInt                       ( uint32_t          address,
                                                              uint32_t        & value );
     bool                     WriteInt                      ( uint32_t          address,
                                                              uint32_t          value );
+    // Byte ranges, translated once per page. They stop at the first page that cannot be
+    // accessed and return false, the pages before it have been transferred already.
+    bool                     ReadBlock                     ( uint32_t          address,
+                                                             void            * data,
+                                                             uint32_t          size );
+    bool                     WriteBlock                    ( uint32_t          address,
+                                                             const void      * data,
+                                                             uint32_t          size );
+    bool                     Fill                          ( uint32_t          address,
+                                                             uint8_t           value,
+                                                             uint32_t          size );
+    bool                     CopyBlock                     ( uint32_t          dst,
+                                                             uint32_t          src,
+                                                             uint32_t          size );
   protected:
     uint32_t               * virtual2Physical              ( uint32_t          address,
                                                              bool              write );
@@ -39,11 +98,162 @@ class CCPU
     {
       return false;
     }
+    // Whoever changes or removes a mapping, or clears its referenced/dirty bits, must drop
+    // the cached translation of the affected pages.
+    void                     tlbInvalidate                 ( uint32_t          address );
+    void                     tlbFlush                      ( void );
+
+    // Direct-mapped translation cache indexed by the logical page number. An entry remembers
+    // whether the page may be written and whether the dirty bits have been set already, so
+    // a hit does neither the page walk nor the referenced/dirty updates.
+    struct TTlbEntry
+    {
+      uint32_t               m_Page;                       // logical page number
+      uint8_t              * m_Frame;                      // NULL = invalid entry
+      uint32_t             * m_Level1;
+      uint32_t             * m_Level2;
+      bool                   m_Write;
+      bool                   m_Dirty;
+    };
 
     uint8_t                * m_MemStart;
     uint32_t                 m_PageTableRoot;
+    TTlbEntry                m_Tlb[TLB_ENTRIES];
+    // Held around every access when another thread may change the mappings of this CPU,
+    // such a thread only touches them after a successful trylock. NULL = not needed.
+    pthread_mutex_t        * m_Guard;
+    // logical page that must stay mapped while CopyBlock translates the other side
+    uint32_t                 m_Pinned;
+    // access trace, NULL = off
+    TTraceRing             * m_Trace;
+  private:
+    uint32_t               * traceAccess                   ( TTlbEntry       & tlb,
+                                                             uint32_t          address,
+                                                             bool              write,
+                                                             bool              fault );
+};
+
+
+struct TMemMgrConfig
+{
+  // SetMemLimit only reserves the quota, pages and page tables are allocated (zeroed) on the first access
+  bool                       m_LazyAlloc;
+  // pages kept zeroed in advance by a background thread for page tables and lazy pages, 0 = no thread
+  uint32_t                   m_ZeroPoolPages;
+  // overcommit: up to this many pages beyond the physical memory, backed by a swap file (at most
+  // 2^20 - 1, a swapped out page table entry holds the slot number in place of the frame)
+  uint32_t                   m_SwapPages;
+  // swap file path, NULL = an anonymous temporary file
+  const char               * m_SwapFile;
+  // SetMemLimit maps whole 4 MiB regions with one large-page directory entry when an aligned
+  // run of 1024 free pages exists (not used together with swap)
+  bool                       m_LargePages;
+  // pages in use are migrated to free whole 4 MiB blocks: by MemMgrCompact, by SetMemLimit when no free
+  // large page is left, and in the background; the processes are stopped for it (CCPU::m_Guard)
+  bool                       m_Compaction;
+  // period of the background compaction, 0 = no background thread
+  uint32_t                   m_CompactIntervalMs;
+  // every successful access of every process is recorded to this file (TTraceRecord), NULL = off
+  const char               * m_TraceFile;
+  // Fault-around: when the faults of a process (demand-zero, swap-in) come page after page, the
+  // pages ahead of the fault are populated as well. The window adapts to how many of the pages
+  // populated ahead get used, this is its upper bound in pages, 0 = off.
+  uint32_t                   m_FaultAround;
+  // same-page merging: identical pages of the processes are mapped read-only copy-on-write to one
+  // frame, the others are freed; by MemMgrDedup and in the background. The processes are stopped
+  // for it (CCPU::m_Guard). The merged pages stay reserved, so a write to them never fails: the
+  // frames freed spare swapping, not quota. Implies m_CowReserve.
+  bool                       m_Dedup;
+  // pages per second examined by the background merging, 0 = no background thread
+  uint32_t                   m_DedupScanRate;
+  // NewProcess with copyMem reserves a page for every page it shares copy-on-write, a write to a
+  // shared page never fails then. Otherwise only the page tables and the pages not populated yet are
+  // reserved and the copy is reserved on the write, which fails (as any failed access) when the
+  // memory and the swap file are fully reserved by then.
+  bool                       m_CowReserve;
 };
 
+// Free physical memory as seen by the buddy allocator, pages cached by the processes and by the
+// zero pool are not counted.
+struct TMemMgrFragStats
+{
+  uint32_t                   m_FreeBlocks[11];             // free blocks of 2^order pages, order 10 is a 4 MiB large page
+  uint32_t                   m_FreePages;
+  uint32_t                   m_LargestBlock;               // pages in the largest free block
+  uint64_t                   m_MigratedPages;              // pages moved by compaction in this MemMgr call
+};
+
+struct TMemMgrSwapStats
+{
+  uint64_t                   m_SwapIns;                    // page faults served from the swap file
+  uint64_t                   m_SwapOuts;                   // pages written to the swap file
+  uint64_t                   m_CleanEvictions;             // evicted pages whose swap copy was still valid
+  uint64_t                   m_Scanned;                    // page table entries examined by the reclaimer
+};
+
+struct TMemMgrProcessStats
+{
+  const CCPU               * m_Cpu;
+  uint32_t                   m_MemLimit;
+  uint32_t                   m_Resident;                   // mapped frames, shared ones (copy-on-write, segments) included
+  uint32_t                   m_Swapped;                    // pages in the swap file
+  uint32_t                   m_PageTables;                 // page tables and the page directory
+  uint64_t                   m_Faults;                     // page faults handled by the memory manager
+  uint64_t                   m_DemandZero;                 // zeroed pages mapped on the first access
+  uint64_t                   m_CowCopies;                  // copy-on-write pages copied on a write
+  uint64_t                   m_CowReuses;                  // copy-on-write pages taken over by their last sharer
+  uint64_t                   m_SwapIns;                    // pages read back from the swap file
+  uint64_t                   m_Prefaulted;                 // pages populated ahead of a fault (m_FaultAround)
+  uint64_t                   m_PrefaultHits;               // of them, found accessed by the time of the next fault
+};
+
+// Snapshot of the memory manager. The global counters are exact, the per-process page counts are
+// taken while the process is stopped when it has a guard (CCPU::m_Guard), otherwise they may be
+// slightly off for a process that changes its mappings meanwhile.
+struct TMemMgrStats
+{
+  uint32_t                   m_TotalPages;
+  uint32_t                   m_FreePages;                  // in the buddy allocator
+  uint32_t                   m_CachedPages;                // free pages held by the per-process caches and the zero pool
+  uint32_t                   m_UsedPages;                  // m_TotalPages - m_FreePages - m_CachedPages
+  uint32_t                   m_ReservedPages;              // quota charged by all the processes
+  uint32_t                   m_SwapPages;
+  uint64_t                   m_AllocatedPages;             // pages taken from the buddy allocator
+  uint64_t                   m_FreedPages;                 // pages given back to it
+  uint64_t                   m_LockAcquisitions;           // of the global allocator lock
+  uint64_t                   m_LockContended;              // acquisitions that had to wait
+  uint64_t                   m_LockWaitNs;                 // total time spent waiting
+  uint64_t                   m_Faults;                     // the fault counters summed over all the processes,
+  uint64_t                   m_DemandZero;                 // the finished ones included
+  uint64_t                   m_CowCopies;
+  uint64_t                   m_CowReuses;
+  uint64_t                   m_SwapIns;
+  uint64_t                   m_Prefaulted;
+  uint64_t                   m_PrefaultHits;
+  uint64_t                   m_DedupScanned;               // pages hashed by the same-page merging
+  uint64_t                   m_DedupMerged;                // frames freed by merging identical pages
+  uint32_t                   m_Processes;
+  TMemMgrProcessStats        m_Process[PROCESS_MAX];
+};
+
+// Counters of the current (or the last) MemMgr call.
+TMemMgrSwapStats             MemMgrSwapStats               ( void );
+TMemMgrFragStats             MemMgrFragStats               ( void );
+TMemMgrStats                 MemMgrStats                   ( void );
+// Writes the snapshot as text, or as one JSON object.
+void                         MemMgrStatsDump               ( FILE            * fp,
+                                                             const TMemMgrStats & stats,
+                                                             bool              json );
+// Compaction pass on demand (TMemMgrConfig::m_Compaction), waits until no process is in the middle
+// of a memory access. Returns the number of free 4 MiB blocks afterwards.
+uint32_t                     MemMgrCompact                 ( void );
+// Same-page merging on demand (TMemMgrConfig::m_Dedup): sweeps all the pages of all the processes
+// until every page that has not changed between two sweeps is merged. Returns the number of frames
+// freed.
+uint32_t                     MemMgrDedup                   ( void );
+
+// Applies to the MemMgr calls that follow, the default is all zero.
+void                         MemMgrSetConfig               ( const TMemMgrConfig & config );
 
 void                         MemMgr                        ( void            * mem,
                                                              uint32_t          totalPages,
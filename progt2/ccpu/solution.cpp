@@ -0,0 +1,2873 @@
+#ifndef __PROGTEST__
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctime>
+#include <atomic>
+#include "common.h"
+using namespace std;
+#endif /* __PROGTEST__ */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+// Set of physical pages, one bit per page. A second level keeps one bit per 64-bit word telling
+// whether the word has any bit set, a third one a bit per non-empty summary word, so the lowest set
+// bit is found with count-trailing-zeros on each level. The third level has at most 4 words for the
+// 2^20 pages a 32-bit address space has.
+class PageBitmap
+{
+    uint64_t* words = nullptr;
+    uint64_t* summary = nullptr;
+    uint64_t* top = nullptr;
+    uint32_t nWords = 0;
+    uint32_t nSummary = 0;
+    uint32_t nTop = 0;
+public:
+    PageBitmap() = default;
+    PageBitmap(const PageBitmap&) = delete;
+    ~PageBitmap()
+    {
+        delete[] words;
+        delete[] summary;
+        delete[] top;
+    }
+    void init(uint32_t count, bool value)
+    {
+        delete[] words;
+        delete[] summary;
+        delete[] top;
+        nWords = (count + 63) / 64;
+        nSummary = (nWords + 63) / 64;
+        nTop = (nSummary + 63) / 64;
+        words = new uint64_t[nWords];
+        summary = new uint64_t[nSummary];
+        top = new uint64_t[nTop];
+        for (uint32_t i = 0; i < nWords; i++)
+            words[i] = 0;
+        for (uint32_t i = 0; i < nSummary; i++)
+            summary[i] = 0;
+        for (uint32_t i = 0; i < nTop; i++)
+            top[i] = 0;
+        if (value)
+            for (uint32_t i = 0; i < count; i++)
+                set(i);
+    }
+    bool test(uint32_t i) const
+    {
+        return (words[i / 64] >> (i % 64)) & 1;
+    }
+    void set(uint32_t i)
+    {
+        uint32_t w = i / 64;
+        words[w] |= 1ull << (i % 64);
+        summary[w / 64] |= 1ull << (w % 64);
+        top[w / 4096] |= 1ull << (w / 64 % 64);
+    }
+    void clear(uint32_t i)
+    {
+        uint32_t w = i / 64;
+        words[w] &= ~(1ull << (i % 64));
+        if (words[w])
+            return;
+        summary[w / 64] &= ~(1ull << (w % 64));
+        if (!summary[w / 64])
+            top[w / 4096] &= ~(1ull << (w / 64 % 64));
+    }
+    // lowest set bit, false if there is none
+    bool findFirst(uint32_t& i) const
+    {
+        uint32_t t = 0;
+        while (t < nTop && !top[t])
+            t++;
+        if (t == nTop)
+            return false;
+        uint32_t s = t * 64 + __builtin_ctzll(top[t]);
+        uint32_t w = s * 64 + __builtin_ctzll(summary[s]);
+        i = w * 64 + __builtin_ctzll(words[w]);
+        return true;
+    }
+};
+
+TMemMgrConfig memMgrConfig;
+
+void MemMgrSetConfig(const TMemMgrConfig& config)
+{
+    memMgrConfig = config;
+}
+
+pthread_mutex_t lock;
+// Sub-quota of a process and of the processes it creates (CCPU::SetQuota). committed counts the
+// memory limits, page tables and page directories of the subtree. Reserving charges the node and
+// all its ancestors, by compare-and-swap against the limit where there is one (0 = none), and
+// undoes the charge when one of them is full. A node lives as long as its process or a child node
+// refers to it.
+struct Quota
+{
+    std::atomic<uint32_t> committed;
+    std::atomic<uint32_t> limit;
+    std::atomic<uint32_t> refs;
+    Quota* parent;
+};
+
+Quota* newQuota(Quota* parent)
+{
+    Quota* q = new Quota;
+    q->committed = 0;
+    q->limit = 0;
+    q->refs = 1;
+    q->parent = parent;
+    if (parent)
+        parent->refs++;
+    return q;
+}
+
+void dropQuota(Quota* q)
+{
+    while (q && --q->refs == 0)
+    {
+        Quota* parent = q->parent;
+        delete q;
+        q = parent;
+    }
+}
+
+void releaseQuota(Quota* q, uint32_t n)
+{
+    for (; q; q = q->parent)
+        q->committed -= n;
+}
+
+bool reserveQuota(Quota* q, uint32_t n)
+{
+    for (Quota* node = q; node; node = node->parent)
+    {
+        if (!node->limit.load(std::memory_order_relaxed))
+        {
+            node->committed += n;
+            continue;
+        }
+        uint32_t committed = node->committed.load(std::memory_order_relaxed);
+        do
+        {
+            if ((uint64_t) committed + n > node->limit.load(std::memory_order_relaxed))
+            {
+                for (Quota* done = q; done != node; done = done->parent)
+                    done->committed -= n;
+                return false;
+            }
+        }
+        while (!node->committed.compare_exchange_weak(committed, committed + n));
+    }
+    return true;
+}
+
+// Buddy allocator of the physical pages. free[o] has a bit for every free block of 2^o pages,
+// aligned to its size, that is not part of a larger free block. Allocation takes the lowest block
+// of the smallest sufficient order and splits it, the upper halves stay free. Freeing merges the
+// block with its buddy as long as the buddy is free as a whole. The largest order is a large page.
+class BuddyAllocator
+{
+public:
+    static const uint32_t ORDERS = 11;
+private:
+    PageBitmap free[ORDERS];
+    uint32_t nFree[ORDERS];
+    void put(uint32_t block, uint32_t order)
+    {
+        free[order].set(block);
+        nFree[order]++;
+    }
+    void remove(uint32_t block, uint32_t order)
+    {
+        free[order].clear(block);
+        nFree[order]--;
+    }
+public:
+    // all pages free, as the largest aligned blocks that fit
+    void init(uint32_t pages)
+    {
+        for (uint32_t o = 0; o < ORDERS; o++)
+        {
+            free[o].init((pages >> o) + 1, false);
+            nFree[o] = 0;
+        }
+        for (uint32_t page = 0; page < pages; )
+        {
+            uint32_t o = ORDERS - 1;
+            while (page % (1u << o) || page + (1u << o) > pages)
+                o--;
+            put(page >> o, o);
+            page += 1u << o;
+        }
+    }
+    // a block of 2^order pages split from a free block of at most 2^maxOrder pages, false if
+    // there is no such block
+    bool take(uint32_t order, uint32_t& page, uint32_t maxOrder = ORDERS - 1)
+    {
+        uint32_t o = order;
+        uint32_t block = 0;
+        while (o <= maxOrder && !(nFree[o] && free[o].findFirst(block)))
+            o++;
+        if (o > maxOrder)
+            return false;
+        remove(block, o);
+        for (; o > order; o--)
+        {
+            block *= 2;
+            put(block + 1, o - 1);
+        }
+        page = block << order;
+        return true;
+    }
+    void release(uint32_t page, uint32_t order = 0)
+    {
+        uint32_t block = page >> order;
+        for (; order < ORDERS - 1 && free[order].test(block ^ 1); order++)
+        {
+            remove(block ^ 1, order);
+            block /= 2;
+        }
+        put(block, order);
+    }
+    // whether a free block covers the block of 2^order pages at page
+    bool isFree(uint32_t page, uint32_t order = 0) const
+    {
+        for (uint32_t o = order; o < ORDERS; o++)
+            if (free[o].test(page >> o))
+                return true;
+        return false;
+    }
+    // Frees n pages, every aligned run of consecutive pages as one block. False (and the rest
+    // stays allocated) when a page is free already.
+    bool releaseRun(const uint32_t* pages, uint32_t n)
+    {
+        for (uint32_t i = 0; i < n; )
+        {
+            uint32_t o = 0;
+            while (o < ORDERS - 1 && pages[i] % (2u << o) == 0 && i + (2u << o) <= n)
+            {
+                uint32_t k = 1u << o;
+                while (k < 2u << o && pages[i + k] == pages[i] + k)
+                    k++;
+                if (k < 2u << o)
+                    break;
+                o++;
+            }
+            if (isFree(pages[i], o))
+                return false;
+            release(pages[i], o);
+            i += 1u << o;
+        }
+        return true;
+    }
+    // Up to n pages in as few contiguous runs as possible, returns how many were found.
+    uint32_t takeRun(uint32_t* out, uint32_t n)
+    {
+        uint32_t taken = 0;
+        while (taken < n)
+        {
+            uint32_t o = 31 - __builtin_clz(n - taken);
+            if (o >= ORDERS)
+                o = ORDERS - 1;
+            uint32_t page;
+            // the largest block that fits the rest, split from a larger one if needed, a smaller one
+            // if memory is fragmented
+            if (!take(o, page))
+            {
+                while (o && !nFree[o])
+                    o--;
+                if (!take(o, page))
+                    break;
+            }
+            for (uint32_t i = 0; i < 1u << o; i++)
+                out[taken++] = page + i;
+        }
+        return taken;
+    }
+    // Removes the free blocks inside the aligned block of 2^order pages at first, returns how
+    // many pages they had. The caller gives the whole block back by release(first, order).
+    uint32_t claim(uint32_t first, uint32_t order)
+    {
+        uint32_t res = 0;
+        for (uint32_t o = 0; o <= order; o++)
+            for (uint32_t b = first >> o; b < (first + (1u << order)) >> o; b++)
+                if (free[o].test(b))
+                {
+                    remove(b, o);
+                    res += 1u << o;
+                }
+        return res;
+    }
+    uint32_t freeBlocks(uint32_t order) const
+    {
+        return nFree[order];
+    }
+};
+
+BuddyAllocator freePages;
+uint32_t global_totalPages;
+uint64_t nPouzitychStranek;
+uint64_t nUvolnenychStranek;
+// pages reserved against global_totalPages + swapPages, changed by atomics only (see zarezervujDanyPocetStranek)
+std::atomic<uint32_t> nRezervovanychStranek(1);
+// pages migrated by compaction
+uint64_t nPresunutychStranek;
+
+unsigned long nLockAcquisitions;
+unsigned long nLockContended;
+uint64_t nLockWaitNs;
+
+uint64_t monotonicNs()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Takes the global lock and counts how often it was already held by someone else. The clock is
+// read only when the lock has to be waited for.
+void lockGlobal()
+{
+    if (pthread_mutex_trylock(&lock) != 0)
+    {
+        uint64_t start = monotonicNs();
+        pthread_mutex_lock(&lock);
+        nLockContended++;
+        nLockWaitNs += monotonicNs() - start;
+    }
+    nLockAcquisitions++;
+}
+
+// Cache of free pages owned by one CProcess. The process allocates from and frees into its
+// magazine without touching the global lock; the magazine refills from and drains to the global
+// bitmap MAGAZINE_BATCH pages at a time. The magazine lock is only ever contended when an
+// allocator that ran dry steals pages from other magazines.
+struct PageMagazine
+{
+    static const uint32_t SIZE = 64;
+    static const uint32_t BATCH = 32;
+
+    pthread_mutex_t lock;
+    uint32_t pages[SIZE];
+    uint32_t count;
+    PageMagazine* prev;
+    PageMagazine* next;
+};
+
+PageMagazine* magazines;
+
+void registerMagazine(PageMagazine* mag)
+{
+    pthread_mutex_init(&mag->lock, NULL);
+    mag->count = 0;
+    lockGlobal();
+    mag->prev = NULL;
+    mag->next = magazines;
+    if (magazines)
+        magazines->prev = mag;
+    magazines = mag;
+    pthread_mutex_unlock(&lock);
+}
+
+// Returns all cached pages, the magazine must not be used afterwards.
+void unregisterMagazine(PageMagazine* mag)
+{
+    pthread_mutex_lock(&mag->lock);
+    lockGlobal();
+    for (uint32_t i = 0; i < mag->count; i++)
+        freePages.release(mag->pages[i]);
+    nUvolnenychStranek += mag->count;
+    if (mag->prev)
+        mag->prev->next = mag->next;
+    else
+        magazines = mag->next;
+    if (mag->next)
+        mag->next->prev = mag->prev;
+    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&mag->lock);
+    pthread_mutex_destroy(&mag->lock);
+}
+
+// Gives back quota that was reserved but never backed by a page.
+void releaseReservation(uint32_t pages)
+{
+    nRezervovanychStranek -= pages;
+}
+
+// TMemMgrConfig::m_CowReserve (or m_Dedup) of this MemMgr call: every mapping of a copy-on-write
+// page (present or swapped out) is charged one page, otherwise the frame (slot) is charged once
+// for all of them
+bool cowReserve;
+
+// pages of the swap file, the quota may exceed the physical memory by that much
+uint32_t swapPages;
+// Evicts a page of some process to the swap file and hands its frame over, false if nothing
+// could be evicted now.
+bool reclaimPage(uint32_t& frame);
+
+// Check-and-add by compare-and-swap, admission never waits for the global lock. Freeing a page
+// gives its quota back right away.
+bool zarezervujDanyPocetStranek(uint32_t newPages)
+{
+    uint32_t capacity = global_totalPages + swapPages;
+    uint32_t reserved = nRezervovanychStranek.load(std::memory_order_relaxed);
+    do
+    {
+        if (newPages > capacity - reserved)
+            return false;
+    }
+    while (!nRezervovanychStranek.compare_exchange_weak(reserved, reserved + newPages));
+    return true;
+}
+
+// Moves up to n pages from the global bitmap to the magazine, the global lock must be held.
+// When the bitmap is empty, the pages are stolen from the other magazines.
+bool takeZeroedPage(uint32_t& page);
+
+bool refillMagazine(PageMagazine* mag, uint32_t n)
+{
+    uint32_t i;
+    while (mag->count < n && freePages.take(0, i))
+    {
+        mag->pages[mag->count++] = i;
+        nPouzitychStranek++;
+    }
+    while (mag->count < n && takeZeroedPage(i))
+        mag->pages[mag->count++] = i;
+    for (PageMagazine* other = magazines; other && !mag->count; other = other->next)
+    {
+        if (other == mag || pthread_mutex_trylock(&other->lock) != 0)
+            continue;
+        while (other->count && mag->count < n)
+            mag->pages[mag->count++] = other->pages[--other->count];
+        pthread_mutex_unlock(&other->lock);
+    }
+    return mag->count > 0;
+}
+
+// Returns the pages cached by the magazines to the buddy allocator so that they can coalesce,
+// the global lock must be held. Busy magazines are skipped.
+void drainMagazines()
+{
+    for (PageMagazine* mag = magazines; mag; mag = mag->next)
+    {
+        if (pthread_mutex_trylock(&mag->lock) != 0)
+            continue;
+        for (uint32_t i = 0; i < mag->count; i++)
+            freePages.release(mag->pages[i]);
+        nUvolnenychStranek += mag->count;
+        mag->count = 0;
+        pthread_mutex_unlock(&mag->lock);
+    }
+}
+
+// Rounds a page fault waits for a reclaimed page before it fails. The faulting process holds its
+// guard all the time, the others cannot reclaim its pages, nor can they stop it for compaction or
+// merging.
+const uint32_t FAULT_RETRIES = 1000;
+
+// A free page, false after retries rounds without one, ~0u = waits until there is one. Without swap
+// the reservation guarantees a page (it may sit in a busy magazine or in the zero pool for a while),
+// the wait is not bounded then.
+bool getFreePage(PageMagazine* mag, uint32_t& page, uint32_t retries)
+{
+    if (mag)
+    {
+        pthread_mutex_lock(&mag->lock);
+        while (!mag->count)
+        {
+            lockGlobal();
+            bool ok = refillMagazine(mag, PageMagazine::BATCH);
+            pthread_mutex_unlock(&lock);
+            // the reservation guarantees a free page, it may sit in a magazine that is busy now,
+            // or, with overcommit, in the swap file
+            if (!ok)
+            {
+                pthread_mutex_unlock(&mag->lock);
+                if (swapPages && reclaimPage(page))
+                    return true;
+                if (swapPages && retries != ~0u && !retries--)
+                    return false;
+                sched_yield();
+                pthread_mutex_lock(&mag->lock);
+            }
+        }
+        page = mag->pages[--mag->count];
+        pthread_mutex_unlock(&mag->lock);
+        return true;
+    }
+    lockGlobal();
+    if (!freePages.take(0, page))
+    {
+        PageMagazine tmp;
+        tmp.count = 0;
+        // the reservation guarantees a free page, it may sit in one of the magazines
+        while (!refillMagazine(&tmp, 1))
+        {
+            pthread_mutex_unlock(&lock);
+            if (swapPages && reclaimPage(page))
+                return true;
+            if (swapPages && retries != ~0u && !retries--)
+                return false;
+            sched_yield();
+            lockGlobal();
+            if (freePages.take(0, page))
+                break;
+        }
+        if (tmp.count)
+        {
+            pthread_mutex_unlock(&lock);
+            page = tmp.pages[0];
+            return true;
+        }
+    }
+    nPouzitychStranek++;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+uint32_t getFreePage(PageMagazine* mag = NULL)
+{
+    uint32_t page;
+    getFreePage(mag, page, ~0u);
+    return page;
+}
+
+// A free page without waiting: from the magazine or the buddy allocator, never reclaimed.
+bool tryGetFreePage(PageMagazine* mag, uint32_t& page)
+{
+    pthread_mutex_lock(&mag->lock);
+    if (!mag->count)
+    {
+        lockGlobal();
+        refillMagazine(mag, PageMagazine::BATCH);
+        pthread_mutex_unlock(&lock);
+    }
+    bool res = mag->count > 0;
+    if (res)
+        page = mag->pages[--mag->count];
+    pthread_mutex_unlock(&mag->lock);
+    return res;
+}
+
+// charged = false keeps the reservation of the page, it moves to another page
+void setPageAsFree(uint32_t page, PageMagazine* mag = NULL, bool charged = true)
+{
+    if (mag)
+    {
+        pthread_mutex_lock(&mag->lock);
+        if (mag->count == PageMagazine::SIZE)
+        {
+            // a page freed twice is caught when its second copy spills into the bitmap
+            lockGlobal();
+            while (mag->count > PageMagazine::SIZE - PageMagazine::BATCH)
+            {
+                uint32_t drained = mag->pages[--mag->count];
+                if (freePages.isFree(drained))
+                {
+                    pthread_mutex_unlock(&lock);
+                    pthread_mutex_unlock(&mag->lock);
+                    throw "error";
+                }
+                freePages.release(drained);
+                nUvolnenychStranek++;
+            }
+            pthread_mutex_unlock(&lock);
+        }
+        mag->pages[mag->count++] = page;
+        pthread_mutex_unlock(&mag->lock);
+        if (charged)
+            nRezervovanychStranek--;
+        return;
+    }
+    lockGlobal();
+    if (freePages.isFree(page))
+    {
+        pthread_mutex_unlock(&lock);
+        throw "error";
+    }
+    freePages.release(page);
+    nUvolnenychStranek++;
+    pthread_mutex_unlock(&lock);
+    if (charged)
+        nRezervovanychStranek--;
+}
+
+uint8_t* memStart;
+
+// Free pages taken out of the bitmap and zeroed in advance by zeroPoolThread. The pages are
+// still free as far as the quota is concerned, allocators fall back to them when the bitmap
+// runs dry. The thread refills the pool whenever it drops below half.
+struct ZeroPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint32_t* pages;
+    uint32_t count;
+    uint32_t size;
+    bool stop;
+} zeroPool;
+
+// Non-temporal stores: the page is zeroed ahead of its use, there is no point in keeping it in the cache.
+void streamZeroPage(uint32_t page)
+{
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i* p = (__m128i*)(memStart + page*CCPU::PAGE_SIZE);
+    for (uint32_t i = 0; i < CCPU::PAGE_SIZE / sizeof(__m128i); i += 4)
+    {
+        _mm_stream_si128(p + i, zero);
+        _mm_stream_si128(p + i + 1, zero);
+        _mm_stream_si128(p + i + 2, zero);
+        _mm_stream_si128(p + i + 3, zero);
+    }
+    _mm_sfence();
+#else
+    memset(memStart + page*CCPU::PAGE_SIZE, 0, CCPU::PAGE_SIZE);
+#endif /* __SSE2__ */
+}
+
+bool takeZeroedPage(uint32_t& page)
+{
+    if (!zeroPool.size)
+        return false;
+    pthread_mutex_lock(&zeroPool.lock);
+    bool res = zeroPool.count > 0;
+    if (res)
+        page = zeroPool.pages[--zeroPool.count];
+    if (zeroPool.count < zeroPool.size / 2)
+        pthread_cond_signal(&zeroPool.cond);
+    pthread_mutex_unlock(&zeroPool.lock);
+    return res;
+}
+
+void * zeroPoolThread(void *)
+{
+    pthread_mutex_lock(&zeroPool.lock);
+    while (!zeroPool.stop)
+    {
+        if (zeroPool.count >= zeroPool.size / 2)
+        {
+            pthread_cond_wait(&zeroPool.cond, &zeroPool.lock);
+            continue;
+        }
+        while (zeroPool.count < zeroPool.size && !zeroPool.stop)
+        {
+            pthread_mutex_unlock(&zeroPool.lock);
+            uint32_t page;
+            lockGlobal();
+            bool found = freePages.take(0, page);
+            if (found)
+                nPouzitychStranek++;
+            pthread_mutex_unlock(&lock);
+            pthread_mutex_lock(&zeroPool.lock);
+            if (!found)
+            {
+                // nothing free now, try again after the next allocation from the pool
+                pthread_cond_wait(&zeroPool.cond, &zeroPool.lock);
+                break;
+            }
+            pthread_mutex_unlock(&zeroPool.lock);
+            streamZeroPage(page);
+            pthread_mutex_lock(&zeroPool.lock);
+            zeroPool.pages[zeroPool.count++] = page;
+        }
+    }
+    pthread_mutex_unlock(&zeroPool.lock);
+    return NULL;
+}
+
+void startZeroPool(uint32_t size)
+{
+    zeroPool.count = 0;
+    zeroPool.size = size;
+    zeroPool.stop = false;
+    if (!size)
+        return;
+    pthread_mutex_init(&zeroPool.lock, NULL);
+    pthread_cond_init(&zeroPool.cond, NULL);
+    zeroPool.pages = new uint32_t[size];
+    pthread_create(&zeroPool.thread, NULL, zeroPoolThread, NULL);
+}
+
+void stopZeroPool()
+{
+    if (!zeroPool.size)
+        return;
+    pthread_mutex_lock(&zeroPool.lock);
+    zeroPool.stop = true;
+    pthread_cond_signal(&zeroPool.cond);
+    pthread_mutex_unlock(&zeroPool.lock);
+    pthread_join(zeroPool.thread, NULL);
+    lockGlobal();
+    for (uint32_t i = 0; i < zeroPool.count; i++)
+        freePages.release(zeroPool.pages[i]);
+    nUvolnenychStranek += zeroPool.count;
+    pthread_mutex_unlock(&lock);
+    delete[] zeroPool.pages;
+    pthread_cond_destroy(&zeroPool.cond);
+    pthread_mutex_destroy(&zeroPool.lock);
+    zeroPool.size = 0;
+}
+
+// A zeroed page from the pool, zeroed here if the pool is empty. False as getFreePage.
+bool getZeroedPage(PageMagazine* mag, uint32_t& page, uint32_t retries)
+{
+    if (takeZeroedPage(page))
+        return true;
+    if (!getFreePage(mag, page, retries))
+        return false;
+    memset(memStart + page*CCPU::PAGE_SIZE, 0, CCPU::PAGE_SIZE);
+    return true;
+}
+
+uint32_t getZeroedPage(PageMagazine* mag = NULL)
+{
+    uint32_t page;
+    getZeroedPage(mag, page, ~0u);
+    return page;
+}
+
+// Allocates up to n pages under a single acquisition of the global lock. When the bitmap is
+// empty (the free pages sit in magazines or in the zero pool, or in the swap file), a single page
+// comes through getFreePage. Returns the number of pages allocated, at least one.
+uint32_t getFreePages(uint32_t* out, uint32_t n, PageMagazine* mag)
+{
+    lockGlobal();
+    uint32_t got = freePages.takeRun(out, n);
+    nPouzitychStranek += got;
+    pthread_mutex_unlock(&lock);
+    if (!got)
+        out[got++] = getFreePage(mag);
+    return got;
+}
+
+// Takes an aligned run of 1024 free pages for a large-page mapping, false if there is none.
+bool getFreeLargePage(uint32_t& first)
+{
+    lockGlobal();
+    bool res = freePages.take(BuddyAllocator::ORDERS - 1, first);
+    if (res)
+        nPouzitychStranek += CCPU::PAGE_DIR_ENTRIES;
+    pthread_mutex_unlock(&lock);
+    return res;
+}
+
+// Frees n pages under a single acquisition of the global lock.
+void setPagesAsFree(const uint32_t* pages, uint32_t n)
+{
+    lockGlobal();
+    if (!freePages.releaseRun(pages, n))
+    {
+        pthread_mutex_unlock(&lock);
+        throw "error";
+    }
+    nUvolnenychStranek += n;
+    pthread_mutex_unlock(&lock);
+    nRezervovanychStranek -= n;
+}
+
+// Frees the 1024 pages taken by getFreeLargePage as one block.
+void setLargePageAsFree(uint32_t first)
+{
+    lockGlobal();
+    if (freePages.isFree(first, BuddyAllocator::ORDERS - 1))
+    {
+        pthread_mutex_unlock(&lock);
+        throw "error";
+    }
+    freePages.release(first, BuddyAllocator::ORDERS - 1);
+    nUvolnenychStranek += CCPU::PAGE_DIR_ENTRIES;
+    pthread_mutex_unlock(&lock);
+    nRezervovanychStranek -= CCPU::PAGE_DIR_ENTRIES;
+}
+
+TMemMgrFragStats MemMgrFragStats()
+{
+    TMemMgrFragStats res = TMemMgrFragStats();
+    lockGlobal();
+    for (uint32_t o = 0; o < BuddyAllocator::ORDERS; o++)
+    {
+        res.m_FreeBlocks[o] = freePages.freeBlocks(o);
+        res.m_FreePages += res.m_FreeBlocks[o] << o;
+        if (res.m_FreeBlocks[o])
+            res.m_LargestBlock = 1u << o;
+    }
+    res.m_MigratedPages = nPresunutychStranek;
+    pthread_mutex_unlock(&lock);
+    return res;
+}
+
+// Number of page table entries that map each physical data page. Pages shared by copy-on-write
+// after NewProcess have more than one mapping and are freed when the last one goes away.
+std::atomic<uint16_t>* pageRefs;
+
+// Overcommit (TMemMgrConfig::m_SwapPages): evicted pages are kept in a swap file, slot s at
+// offset s * PAGE_SIZE, slot 0 is not used. The page table entry of an evicted page holds the
+// slot instead of the frame, with BIT_SWAPPED set and BIT_PRESENT clear. Copy-on-write children
+// share the slots of the parent (slotRefs). A page read back from a slot nobody else uses keeps
+// the slot (frameSlot) and is not written again if it is evicted before it gets dirty.
+struct SwapSpace
+{
+    pthread_mutex_t lock;
+    int fd;
+    PageBitmap freeSlots;
+    uint16_t* slotRefs;
+    uint32_t* frameSlot;
+    std::atomic<uint64_t> swapIns;
+    std::atomic<uint64_t> swapOuts;
+    std::atomic<uint64_t> cleanEvictions;
+    std::atomic<uint64_t> scanned;
+} swapSpace;
+
+// A swapped out page table entry holds the slot in place of the frame, slots 1 .. 2^20 - 1 fit there.
+const uint32_t SWAP_PAGES_MAX = (1u << (32 - CCPU::OFFSET_BITS)) - 1;
+
+void startSwap(const TMemMgrConfig& config, uint32_t totalPages)
+{
+    // clamped to what the entries can address and what the reservation counter can hold on top of the memory
+    uint32_t maxPages = UINT32_MAX - totalPages < SWAP_PAGES_MAX ? UINT32_MAX - totalPages : SWAP_PAGES_MAX;
+    swapPages = config.m_SwapPages < maxPages ? config.m_SwapPages : maxPages;
+    swapSpace.swapIns = 0;
+    swapSpace.swapOuts = 0;
+    swapSpace.cleanEvictions = 0;
+    swapSpace.scanned = 0;
+    if (!swapPages)
+        return;
+    if (config.m_SwapFile)
+        swapSpace.fd = open(config.m_SwapFile, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    else
+    {
+        FILE* f = tmpfile();
+        swapSpace.fd = f ? dup(fileno(f)) : -1;
+        if (f)
+            fclose(f);
+    }
+    if (swapSpace.fd < 0)
+        throw "error";
+    pthread_mutex_init(&swapSpace.lock, NULL);
+    swapSpace.freeSlots.init(swapPages + 1, true);
+    swapSpace.freeSlots.clear(0);
+    swapSpace.slotRefs = new uint16_t[swapPages + 1]();
+    swapSpace.frameSlot = new uint32_t[totalPages]();
+}
+
+void stopSwap()
+{
+    if (!swapPages)
+        return;
+    close(swapSpace.fd);
+    delete[] swapSpace.slotRefs;
+    delete[] swapSpace.frameSlot;
+    pthread_mutex_destroy(&swapSpace.lock);
+    swapPages = 0;
+}
+
+// Frees the slots kept by resident pages, their contents are in memory anyway. The swap lock must be held.
+void dropRetainedSlots()
+{
+    for (uint32_t page = 0; page < global_totalPages; page++)
+        if (swapSpace.frameSlot[page])
+        {
+            swapSpace.slotRefs[swapSpace.frameSlot[page]] = 0;
+            swapSpace.freeSlots.set(swapSpace.frameSlot[page]);
+            swapSpace.frameSlot[page] = 0;
+        }
+}
+
+// Writes the frame out (unless its retained slot is still valid), false if the swap file is full.
+bool swapOut(uint32_t page, bool dirty, uint32_t& slot)
+{
+    pthread_mutex_lock(&swapSpace.lock);
+    slot = swapSpace.frameSlot[page];
+    if (!slot)
+    {
+        if (!swapSpace.freeSlots.findFirst(slot))
+        {
+            dropRetainedSlots();
+            if (!swapSpace.freeSlots.findFirst(slot))
+            {
+                pthread_mutex_unlock(&swapSpace.lock);
+                return false;
+            }
+        }
+        swapSpace.freeSlots.clear(slot);
+        swapSpace.slotRefs[slot] = 1;
+        dirty = true;
+    }
+    swapSpace.frameSlot[page] = 0;
+    pthread_mutex_unlock(&swapSpace.lock);
+    if (!dirty)
+    {
+        swapSpace.cleanEvictions++;
+        return true;
+    }
+    if (pwrite(swapSpace.fd, memStart + page*CCPU::PAGE_SIZE, CCPU::PAGE_SIZE, (off_t) slot * CCPU::PAGE_SIZE) != CCPU::PAGE_SIZE)
+        throw "error";
+    swapSpace.swapOuts++;
+    return true;
+}
+
+// Reads the slot into the frame. Returns true if the frame took the slot over (the slot was not
+// shared), otherwise the reference to the slot is dropped.
+bool swapIn(uint32_t page, uint32_t slot)
+{
+    if (pread(swapSpace.fd, memStart + page*CCPU::PAGE_SIZE, CCPU::PAGE_SIZE, (off_t) slot * CCPU::PAGE_SIZE) != CCPU::PAGE_SIZE)
+        throw "error";
+    swapSpace.swapIns++;
+    pthread_mutex_lock(&swapSpace.lock);
+    bool retained = swapSpace.slotRefs[slot] == 1;
+    if (retained)
+        swapSpace.frameSlot[page] = slot;
+    else
+        swapSpace.slotRefs[slot]--;
+    pthread_mutex_unlock(&swapSpace.lock);
+    return retained;
+}
+
+bool slotShared(uint32_t slot)
+{
+    pthread_mutex_lock(&swapSpace.lock);
+    bool res = swapSpace.slotRefs[slot] > 1;
+    pthread_mutex_unlock(&swapSpace.lock);
+    return res;
+}
+
+void shareSlot(uint32_t slot, uint32_t n = 1)
+{
+    pthread_mutex_lock(&swapSpace.lock);
+    swapSpace.slotRefs[slot] += n;
+    pthread_mutex_unlock(&swapSpace.lock);
+}
+
+// An evicted page goes away, true if it was the last reference to the slot (the quota of the page is free then).
+bool dropSlot(uint32_t slot)
+{
+    pthread_mutex_lock(&swapSpace.lock);
+    bool last = --swapSpace.slotRefs[slot] == 0;
+    if (last)
+        swapSpace.freeSlots.set(slot);
+    pthread_mutex_unlock(&swapSpace.lock);
+    return last;
+}
+
+// The frame is being freed, its retained slot (if any) goes with it.
+void releaseFrameSlot(uint32_t page)
+{
+    if (!swapPages)
+        return;
+    pthread_mutex_lock(&swapSpace.lock);
+    uint32_t slot = swapSpace.frameSlot[page];
+    if (slot)
+    {
+        swapSpace.frameSlot[page] = 0;
+        swapSpace.slotRefs[slot] = 0;
+        swapSpace.freeSlots.set(slot);
+    }
+    pthread_mutex_unlock(&swapSpace.lock);
+}
+
+// the retained swap copy follows a migrated page
+void moveFrameSlot(uint32_t from, uint32_t to)
+{
+    if (!swapPages)
+        return;
+    pthread_mutex_lock(&swapSpace.lock);
+    swapSpace.frameSlot[to] = swapSpace.frameSlot[from];
+    swapSpace.frameSlot[from] = 0;
+    pthread_mutex_unlock(&swapSpace.lock);
+}
+
+TMemMgrSwapStats MemMgrSwapStats()
+{
+    TMemMgrSwapStats res;
+    res.m_SwapIns = swapSpace.swapIns;
+    res.m_SwapOuts = swapSpace.swapOuts;
+    res.m_CleanEvictions = swapSpace.cleanEvictions;
+    res.m_Scanned = swapSpace.scanned;
+    return res;
+}
+
+void releasePage(uint32_t page, PageMagazine* mag)
+{
+    if (pageRefs[page].fetch_sub(1) == 1)
+    {
+        releaseFrameSlot(page);
+        setPageAsFree(page, mag);
+    }
+    else if (cowReserve)
+        releaseReservation(1);
+}
+
+// Shared memory segment (CCPU::CreateSegment), the pages are freed with the last reference.
+struct Segment
+{
+    uint32_t pages;
+    uint32_t* frames;
+    std::atomic<uint32_t> refs;
+};
+
+const int SEGMENT_MAX = 1024;
+pthread_mutex_t segmentsLock = PTHREAD_MUTEX_INITIALIZER;
+Segment* segments[SEGMENT_MAX];
+
+int createSegment(uint32_t pages, PageMagazine* mag)
+{
+    if (!pages || !zarezervujDanyPocetStranek(pages))
+        return -1;
+    Segment* segment = new Segment;
+    segment->pages = pages;
+    segment->frames = new uint32_t[pages];
+    segment->refs = 1;
+    for (uint32_t i = 0; i < pages; i++)
+        segment->frames[i] = getZeroedPage(mag);
+    pthread_mutex_lock(&segmentsLock);
+    int id = 0;
+    while (id < SEGMENT_MAX && segments[id])
+        id++;
+    if (id < SEGMENT_MAX)
+        segments[id] = segment;
+    pthread_mutex_unlock(&segmentsLock);
+    if (id == SEGMENT_MAX)
+    {
+        setPagesAsFree(segment->frames, pages);
+        delete[] segment->frames;
+        delete segment;
+        return -1;
+    }
+    return id;
+}
+
+// A new reference to the segment, NULL if there is no such segment.
+Segment* acquireSegment(int id)
+{
+    if (id < 0 || id >= SEGMENT_MAX)
+        return NULL;
+    pthread_mutex_lock(&segmentsLock);
+    Segment* res = segments[id];
+    if (res)
+        res->refs++;
+    pthread_mutex_unlock(&segmentsLock);
+    return res;
+}
+
+void releaseSegment(Segment* segment)
+{
+    if (--segment->refs == 0)
+    {
+        setPagesAsFree(segment->frames, segment->pages);
+        delete[] segment->frames;
+        delete segment;
+    }
+}
+
+// Drops the reference of the creator, the id goes away.
+bool releaseSegmentId(int id)
+{
+    if (id < 0 || id >= SEGMENT_MAX)
+        return false;
+    pthread_mutex_lock(&segmentsLock);
+    Segment* segment = segments[id];
+    segments[id] = NULL;
+    pthread_mutex_unlock(&segmentsLock);
+    if (!segment)
+        return false;
+    releaseSegment(segment);
+    return true;
+}
+
+// Segments whose creators did not release them, at the end of MemMgr.
+void resetSegments()
+{
+    for (int id = 0; id < SEGMENT_MAX; id++)
+        if (segments[id])
+        {
+            delete[] segments[id]->frames;
+            delete segments[id];
+            segments[id] = NULL;
+        }
+}
+
+class CProcess;
+
+// reverse map entry of compaction: the process and the logical page a physical page is mapped at,
+// or the first logical page the page table maps, or the page directory of the process
+struct FrameOwner
+{
+    enum { PAGE, TABLE, DIRECTORY };
+    CProcess* process;
+    uint32_t page;
+    int kind;
+};
+bool compactMemory(uint32_t wanted, uint32_t& freeLarge);
+struct DedupCandidate;
+// the process run by this thread
+thread_local CCPU* currentProcess;
+
+struct NewProcessData
+{
+    void * processArg;
+    CCPU* process;
+    void (* entryPoint) ( CCPU *, void * );
+    NewProcessData* next;
+};
+
+// Threads that run the processes created by NewProcess. A thread that finishes a process picks
+// the next one from the queue, or waits for one. New threads are only started when no thread is
+// idle, up to PROCESS_MAX of them, which is as many processes as may run at once; any excess waits
+// in the queue. MemMgr waits for the last process to finish and then stops the threads.
+struct ProcessPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    NewProcessData* head;
+    NewProcessData* tail;
+    uint32_t queued;
+    uint32_t idle;
+    uint32_t nThreads;
+    uint32_t running;        // processes queued or running
+    bool stop;
+    pthread_t threads[PROCESS_MAX];
+} processPool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+void * worker(void *)
+{
+    pthread_mutex_lock(&processPool.lock);
+    while (true)
+    {
+        while (!processPool.head && !processPool.stop)
+        {
+            processPool.idle++;
+            pthread_cond_wait(&processPool.work, &processPool.lock);
+            processPool.idle--;
+        }
+        if (!processPool.head)
+            break;
+        NewProcessData* data = processPool.head;
+        processPool.head = data->next;
+        if (!processPool.head)
+            processPool.tail = NULL;
+        processPool.queued--;
+        pthread_mutex_unlock(&processPool.lock);
+
+        currentProcess = data->process;
+        data->entryPoint(data->process, data->processArg);
+        delete data->process;
+        currentProcess = NULL;
+        delete data;
+
+        pthread_mutex_lock(&processPool.lock);
+        if (--processPool.running == 0)
+            pthread_cond_broadcast(&processPool.done);
+    }
+    pthread_mutex_unlock(&processPool.lock);
+    return NULL;
+}
+
+void startProcess(NewProcessData* data)
+{
+    data->next = NULL;
+    pthread_mutex_lock(&processPool.lock);
+    if (processPool.tail)
+        processPool.tail->next = data;
+    else
+        processPool.head = data;
+    processPool.tail = data;
+    processPool.queued++;
+    processPool.running++;
+    if (processPool.idle >= processPool.queued)
+        pthread_cond_signal(&processPool.work);
+    else if (processPool.nThreads < PROCESS_MAX
+             && pthread_create(&processPool.threads[processPool.nThreads], NULL, worker, NULL) == 0)
+        processPool.nThreads++;
+    pthread_mutex_unlock(&processPool.lock);
+}
+
+// Waits until all processes have finished and stops the threads.
+void joinProcesses()
+{
+    pthread_mutex_lock(&processPool.lock);
+    while (processPool.running)
+        pthread_cond_wait(&processPool.done, &processPool.lock);
+    processPool.stop = true;
+    pthread_cond_broadcast(&processPool.work);
+    pthread_mutex_unlock(&processPool.lock);
+    for (uint32_t i = 0; i < processPool.nThreads; i++)
+        pthread_join(processPool.threads[i], NULL);
+    processPool.nThreads = 0;
+    processPool.stop = false;
+}
+
+// Fault counters of a process. Only the thread of the process writes them, a relaxed load and
+// store is enough and costs no locked instruction; MemMgrStats reads them at any time.
+struct FaultCounters
+{
+    std::atomic<uint64_t> faults;
+    std::atomic<uint64_t> demandZero;
+    std::atomic<uint64_t> cowCopies;
+    std::atomic<uint64_t> cowReuses;
+    std::atomic<uint64_t> swapIns;
+    std::atomic<uint64_t> prefaulted;
+    std::atomic<uint64_t> prefaultHits;
+
+    FaultCounters() : faults(0), demandZero(0), cowCopies(0), cowReuses(0), swapIns(0), prefaulted(0), prefaultHits(0)
+    {
+    }
+    static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void clear()
+    {
+        faults = demandZero = cowCopies = cowReuses = swapIns = prefaulted = prefaultHits = 0;
+    }
+    void add(const FaultCounters& other)
+    {
+        faults += other.faults;
+        demandZero += other.demandZero;
+        cowCopies += other.cowCopies;
+        cowReuses += other.cowReuses;
+        swapIns += other.swapIns;
+        prefaulted += other.prefaulted;
+        prefaultHits += other.prefaultHits;
+    }
+};
+
+// counters of the processes that have finished, under CProcess::processesLock
+FaultCounters exitedCounters;
+
+// Access trace (TMemMgrConfig::m_TraceFile): each process fills its own ring (CCPU::traceAccess),
+// a background thread moves the records to the file. The rings are drained under
+// CProcess::processesLock only, the last time when the process unregisters.
+struct TraceWriter
+{
+    static const uint32_t RING_RECORDS = 1 << 16;
+
+    FILE* file;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint16_t nextProcess;
+    bool stop;
+} traceWriter;
+
+uint32_t drainTrace(TTraceRing* ring)
+{
+    uint32_t head = __atomic_load_n(&ring->m_Head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->m_Tail;
+    uint32_t n = head - tail;
+    uint32_t first = tail & (ring->m_Size - 1);
+    uint32_t chunk = n < ring->m_Size - first ? n : ring->m_Size - first;
+    fwrite(ring->m_Records + first, sizeof(TTraceRecord), chunk, traceWriter.file);
+    fwrite(ring->m_Records, sizeof(TTraceRecord), n - chunk, traceWriter.file);
+    __atomic_store_n(&ring->m_Tail, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+class CProcess : public CCPU
+{
+private:
+    // available to software in the page table entry: the page is shared copy-on-write,
+    // it is mapped read-only and gets a private copy on the first write
+    static const uint32_t BIT_COW = 0x0200;
+    // not present, the entry holds the swap slot of the page (see SwapSpace)
+    static const uint32_t BIT_SWAPPED = 0x0400;
+    // the page belongs to a shared segment
+    static const uint32_t BIT_SHARED = 0x0800;
+
+    // protects the mappings against the reclaimer when overcommit is on (CCPU::m_Guard)
+    pthread_mutex_t guard;
+    void lockGuard()
+    {
+        if (m_Guard)
+            pthread_mutex_lock(m_Guard);
+    }
+    void unlockGuard()
+    {
+        if (m_Guard)
+            pthread_mutex_unlock(m_Guard);
+    }
+
+    void copyPage(uint32_t dst, uint32_t src)
+    {
+        memcpy(m_MemStart + dst*PAGE_SIZE, m_MemStart + src*PAGE_SIZE, PAGE_SIZE);
+    }
+    PageMagazine magazine;
+    uint32_t getFreePageDir()
+    {
+        return getZeroedPage(&magazine);
+    }
+
+    uint32_t* pageDirEntry(uint32_t logicalPage)
+    {
+        return (uint32_t*)(m_MemStart + m_PageTableRoot) + logicalPage / PAGE_DIR_ENTRIES;
+    }
+    // NULL if the page table covering logicalPage has not been allocated, or if a large page maps it
+    uint32_t* pageTableEntry(uint32_t logicalPage)
+    {
+        uint32_t dir = *pageDirEntry(logicalPage);
+        if (!(dir & BIT_PRESENT) || (dir & BIT_LARGE))
+            return NULL;
+        return (uint32_t*)(m_MemStart + (dir & ADDR_MASK)) + logicalPage % PAGE_DIR_ENTRIES;
+    }
+    // allocates the missing page table, its quota is reserved together with the pages it maps;
+    // NULL if no page comes within retries (see getFreePage)
+    uint32_t* pageTableEntryAlloc(uint32_t logicalPage, uint32_t retries = ~0u)
+    {
+        uint32_t* dir = pageDirEntry(logicalPage);
+        if (*dir & BIT_LARGE)
+            splitLargePage(logicalPage);
+        if (!(*dir & BIT_PRESENT))
+        {
+            uint32_t table;
+            if (!getZeroedPage(&magazine, table, retries))
+                return NULL;
+            *dir = (table << 12) + BIT_USER + BIT_WRITE + BIT_PRESENT;
+        }
+        return pageTableEntry(logicalPage);
+    }
+    // Replaces the large page covering logicalPage by a page table mapping the same frames, for the
+    // operations that work on 4 KiB pages (partial shrink, copy-on-write). The table takes the quota
+    // SetMemLimit has reserved for it. The frames get their reference counts only here.
+    void splitLargePage(uint32_t logicalPage)
+    {
+        uint32_t* dir = pageDirEntry(logicalPage);
+        uint32_t table = getFreePageDir();
+        uint32_t* p = (uint32_t*)(m_MemStart + table*PAGE_SIZE);
+        uint32_t first = *dir >> 12;
+        uint32_t flags = *dir & ~ADDR_MASK & ~BIT_LARGE;
+        for (uint32_t i = 0; i < PAGE_DIR_ENTRIES; i++)
+        {
+            pageRefs[first + i] = 1;
+            p[i] = ((first + i) << 12) | flags;
+        }
+        *dir = (table << 12) + BIT_USER + BIT_WRITE + BIT_PRESENT;
+        tlbFlush();
+    }
+    static uint32_t pageTables(uint32_t pages)
+    {
+        return (pages + PAGE_DIR_ENTRIES - 1) / PAGE_DIR_ENTRIES;
+    }
+
+    // sub-quota node of this process
+    Quota* quota;
+    FaultCounters counters;
+
+    // Pages [0, pagesLimit) are reserved. A page that is not present in the page table is
+    // allocated on the first access, the same holds for the page tables.
+    uint32_t pagesLimit = 0;
+    static const uint32_t PAGE_FLAGS = BIT_DIRTY + BIT_REFERENCED + BIT_USER + BIT_WRITE + BIT_PRESENT;
+    // Large shrinks free each page table's worth of pages under one acquisition of the global
+    // lock, small ones go through the magazine.
+    void shrink(uint32_t pages)
+    {
+        bool batch = pagesLimit - pages >= PageMagazine::BATCH;
+        uint32_t freed[PAGE_DIR_ENTRIES + 1];
+        uint32_t unreserved = 0;
+        while (pagesLimit > pages)
+        {
+            // one page table at a time, from the end
+            uint32_t first = (pagesLimit - 1) / PAGE_DIR_ENTRIES * PAGE_DIR_ENTRIES;
+            if (first < pages)
+                first = pages;
+            uint32_t* dir = pageDirEntry(first);
+            bool wholeTable = first % PAGE_DIR_ENTRIES == 0;
+            if ((*dir & BIT_LARGE) && !wholeTable)
+                splitLargePage(first);
+            if (*dir & BIT_LARGE)
+            {
+                // the whole large page goes at once, together with the quota of its (never allocated) table
+                uint32_t base = *dir >> 12;
+                *dir = 0;
+                tlbFlush();
+                setLargePageAsFree(base);
+                unreserved++;
+            }
+            else if (*dir & BIT_PRESENT)
+            {
+                uint32_t nFreed = 0;
+                uint32_t* p = pageTableEntry(first);
+                for (uint32_t i = first; i < pagesLimit; i++, p++)
+                {
+                    if (*p & BIT_PRESENT)
+                    {
+                        tlbInvalidate(i << OFFSET_BITS);
+                        uint32_t page = *p >> 12;
+                        if (!batch)
+                            releasePage(page, &magazine);
+                        else if (pageRefs[page].fetch_sub(1) == 1)
+                        {
+                            releaseFrameSlot(page);
+                            freed[nFreed++] = page;
+                        }
+                        else if (cowReserve)
+                            unreserved++;
+                    }
+                    else if (*p & BIT_SWAPPED)
+                    {
+                        if (dropSlot(*p >> 12) || cowReserve)
+                            unreserved++;
+                    }
+                    else
+                        unreserved++;
+                    *p = 0;
+                }
+                if (wholeTable)
+                {
+                    if (batch)
+                        freed[nFreed++] = *dir >> 12;
+                    else
+                        setPageAsFree(*dir >> 12, &magazine);
+                    *dir = 0;
+                }
+                if (nFreed)
+                    setPagesAsFree(freed, nFreed);
+            }
+            else
+                unreserved += pagesLimit - first + (wholeTable ? 1 : 0);
+            pagesLimit = first;
+        }
+        releaseReservation(unreserved);
+    }
+    // pages in [0, pagesLimit) not backed by a physical page (or a swap slot) yet
+    uint32_t absentPages()
+    {
+        uint32_t res = 0;
+        for (uint32_t i = 0; i < pagesLimit; i++)
+        {
+            if (*pageDirEntry(i) & BIT_LARGE)
+            {
+                i += PAGE_DIR_ENTRIES - 1;
+                continue;
+            }
+            uint32_t* p = pageTableEntry(i);
+            if (!p || !(*p & (BIT_PRESENT | BIT_SWAPPED)))
+                res++;
+        }
+        return res;
+    }
+    // Maps all pages of parent into this (empty) process, both sides end up read-only copy-on-write.
+    // Pages the parent has not touched yet stay demand-zero in the child as well, swapped out
+    // pages share the swap slot. Large pages of the parent are split, copy-on-write works on 4 KiB pages.
+    void shareMemory(CProcess& parent)
+    {
+        for (uint32_t i = 0; i < parent.pagesLimit; i++)
+        {
+            if (*parent.pageDirEntry(i) & BIT_LARGE)
+                parent.splitLargePage(i);
+            uint32_t* p = parent.pageTableEntry(i);
+            if (!p)
+            {
+                i += PAGE_DIR_ENTRIES - 1 - i % PAGE_DIR_ENTRIES;
+                continue;
+            }
+            if (*p & BIT_SWAPPED)
+            {
+                shareSlot(*p >> 12);
+                *pageTableEntryAlloc(i) = *p;
+                continue;
+            }
+            if (!(*p & BIT_PRESENT))
+                continue;
+            if (*p & BIT_WRITE)
+            {
+                *p = (*p & ~BIT_WRITE) | BIT_COW;
+                parent.tlbInvalidate(i << OFFSET_BITS);
+            }
+            pageRefs[*p >> 12]++;
+            *pageTableEntryAlloc(i) = *p;
+        }
+        pagesLimit = parent.pagesLimit;
+    }
+    // Write to a copy-on-write page: the last sharer takes the page over, the others copy it.
+    // With cowReserve, the copy is backed by the charge of the mapping.
+    bool breakCow(uint32_t* p)
+    {
+        uint32_t entry = *p;
+        uint32_t page = entry >> 12;
+        uint32_t flags = (entry & ~ADDR_MASK & ~BIT_COW) | BIT_WRITE;
+        if (pageRefs[page].load() == 1)
+        {
+            *p = (page << 12) | flags;
+            FaultCounters::bump(counters.cowReuses);
+            return true;
+        }
+        if (!cowReserve && !zarezervujDanyPocetStranek(1))
+            return false;
+        uint32_t copy;
+        if (!getFreePage(&magazine, copy, FAULT_RETRIES))
+        {
+            if (!cowReserve)
+                releaseReservation(1);
+            return false;
+        }
+        if (*p != entry)
+        {
+            // the reclaim has evicted the shared page (maybe handing its very frame over), the
+            // access is retried and faults on the swap slot then
+            setPageAsFree(copy, &magazine, !cowReserve);
+            return true;
+        }
+        FaultCounters::bump(counters.cowCopies);
+        copyPage(copy, page);
+        pageRefs[copy] = 1;
+        *p = (copy << 12) | flags;
+        // the other sharers may have gone away meanwhile, the charge of the mapping went to the copy
+        if (pageRefs[page].fetch_sub(1) == 1)
+        {
+            releaseFrameSlot(page);
+            setPageAsFree(page, &magazine, !cowReserve);
+        }
+        return true;
+    }
+    // Reads an evicted page back. A slot shared with other processes stays with them and the
+    // page gets a new charge, as when breaking copy-on-write (unless cowReserve). The reclaim
+    // run by getFreePage only evicts present pages, the entry stays as it is meanwhile.
+    bool swapInPage(uint32_t* p)
+    {
+        uint32_t slot = *p >> 12;
+        bool charged = !cowReserve && slotShared(slot);
+        if (charged && !zarezervujDanyPocetStranek(1))
+            return false;
+        uint32_t page;
+        if (!getFreePage(&magazine, page, FAULT_RETRIES))
+        {
+            if (charged)
+                releaseReservation(1);
+            return false;
+        }
+        FaultCounters::bump(counters.swapIns);
+        if (swapIn(page, slot) && charged)
+            releaseReservation(1);  // the other sharers went away meanwhile
+        pageRefs[page] = 1;
+        *p = (page << 12) + BIT_USER + BIT_WRITE + BIT_PRESENT;
+        return true;
+    }
+
+    // Fault-around (TMemMgrConfig::m_FaultAround). The pages of the last window are mapped without
+    // BIT_REFERENCED, the CPU sets it on their first access; at the next fault the share of the
+    // window used so far decides: most of it -> the window doubles, less than a half -> it halves.
+    // Populated ahead are only pages that need neither reclaim nor a new page table.
+    uint32_t raNext = ~0u;          // a fault here continues the stream
+    uint32_t raStart = 0;
+    uint32_t raCount = 0;
+    uint32_t raWindow = 4;
+    void faultAround(uint32_t logicalPage)
+    {
+        uint32_t maxWindow = memMgrConfig.m_FaultAround;
+        if (!maxWindow)
+            return;
+        bool sequential = logicalPage == raNext;
+        if (raCount)
+        {
+            uint32_t used = 0;
+            for (uint32_t i = raStart; i < raStart + raCount && i < pagesLimit; i++)
+            {
+                uint32_t* p = pageTableEntry(i);
+                if (p && (*p & BIT_PRESENT) && (*p & BIT_REFERENCED))
+                    used++;
+            }
+            FaultCounters::bump(counters.prefaultHits, used);
+            if (sequential && used * 4 >= raCount * 3)
+                raWindow = raWindow * 2 < maxWindow ? raWindow * 2 : maxWindow;
+            else if (used * 2 < raCount)
+                raWindow = raWindow / 2 ? raWindow / 2 : 1;
+        }
+        raStart = logicalPage + 1;
+        raCount = 0;
+        if (sequential)
+        {
+            if (raWindow > maxWindow)
+                raWindow = maxWindow;
+            while (raCount < raWindow && prefault(raStart + raCount))
+                raCount++;
+            FaultCounters::bump(counters.prefaulted, raCount);
+        }
+        raNext = raStart + raCount;
+    }
+    // Maps the absent (or privately swapped) page ahead of a fault, false if it is not worth it or
+    // would have to wait for memory.
+    bool prefault(uint32_t logicalPage)
+    {
+        if (logicalPage >= pagesLimit)
+            return false;
+        uint32_t dir = *pageDirEntry(logicalPage);
+        if (!(dir & BIT_PRESENT) || (dir & BIT_LARGE))
+            return false;
+        uint32_t* p = pageTableEntry(logicalPage);
+        bool swapped = *p & BIT_SWAPPED;
+        if ((*p & BIT_PRESENT) || (swapped && slotShared(*p >> 12)))
+            return false;
+        uint32_t page;
+        bool zeroed = takeZeroedPage(page);
+        if (!zeroed && !tryGetFreePage(&magazine, page))
+            return false;
+        if (swapped)
+            swapIn(page, *p >> 12);
+        else if (!zeroed)
+            memset(m_MemStart + page*PAGE_SIZE, 0, PAGE_SIZE);
+        pageRefs[page] = 1;
+        *p = (page << 12) + BIT_USER + BIT_WRITE + BIT_PRESENT;
+        return true;
+    }
+
+    uint32_t clockHand = 0;
+    // Second chance: a page referenced since the last visit of the hand loses the referenced bit,
+    // the first one without it is evicted. Pages shared copy-on-write are left alone. Called by
+    // the reclaimer, with the guard held either by this thread or by the reclaiming thread.
+    bool evictPage(uint32_t& frame)
+    {
+        uint32_t scanned = 0;
+        bool res = false;
+        for (uint32_t steps = 0; steps < 2 * pagesLimit && !res; steps++)
+        {
+            if (clockHand >= pagesLimit)
+                clockHand = 0;
+            uint32_t i = clockHand++;
+            uint32_t* p = pageTableEntry(i);
+            if (!p)
+            {
+                clockHand = (i / PAGE_DIR_ENTRIES + 1) * PAGE_DIR_ENTRIES;
+                continue;
+            }
+            scanned++;
+            if (!(*p & BIT_PRESENT) || i == m_Pinned)
+                continue;
+            uint32_t page = *p >> 12;
+            if (pageRefs[page].load() != 1)
+                continue;
+            if (*p & BIT_REFERENCED)
+            {
+                *p &= ~BIT_REFERENCED;
+                tlbInvalidate(i << OFFSET_BITS);
+                continue;
+            }
+            uint32_t slot;
+            if (!swapOut(page, *p & BIT_DIRTY, slot))
+                break;
+            tlbInvalidate(i << OFFSET_BITS);
+            *p = (slot << 12) | BIT_SWAPPED;
+            pageRefs[page] = 0;
+            frame = page;
+            res = true;
+        }
+        swapSpace.scanned += scanned;
+        return res;
+    }
+    // Finds a present page shared copy-on-write, starting at the clock hand. Returns its frame, ~0 if there is none.
+    uint32_t findSharedPage()
+    {
+        for (uint32_t steps = 0; steps < pagesLimit; steps++)
+        {
+            if (clockHand >= pagesLimit)
+                clockHand = 0;
+            uint32_t i = clockHand++;
+            uint32_t* p = pageTableEntry(i);
+            if (p && (*p & BIT_PRESENT) && i != m_Pinned && pageRefs[*p >> 12].load() > 1)
+                return *p >> 12;
+        }
+        return ~0u;
+    }
+    // Reverse map of the private pages for compaction, together with the page directory and the
+    // page tables below the limit. Shared, segment and large pages, the tables of the segments
+    // and the page CopyBlock has pinned stay where they are.
+    void collectOwners(FrameOwner* owners)
+    {
+        owners[m_PageTableRoot >> 12] = FrameOwner{this, 0, FrameOwner::DIRECTORY};
+        for (uint32_t i = 0; i < pagesLimit; i++)
+        {
+            uint32_t* p = pageTableEntry(i);
+            if (!p)
+            {
+                i += PAGE_DIR_ENTRIES - 1 - i % PAGE_DIR_ENTRIES;
+                continue;
+            }
+            if (i % PAGE_DIR_ENTRIES == 0)
+                owners[*pageDirEntry(i) >> 12] = FrameOwner{this, i, FrameOwner::TABLE};
+            if ((*p & BIT_PRESENT) && !(*p & BIT_SHARED) && i != m_Pinned && pageRefs[*p >> 12].load() == 1)
+                owners[*p >> 12] = FrameOwner{this, i, FrameOwner::PAGE};
+        }
+    }
+    // Moves the page (table, directory) owner describes to the frame dst, the process must be
+    // stopped. The TLB keeps pointers to the tables, it is flushed when one of them moves.
+    void migratePage(const FrameOwner& owner, uint32_t dst)
+    {
+        uint32_t* p = owner.kind == FrameOwner::PAGE ? pageTableEntry(owner.page) : pageDirEntry(owner.page);
+        if (owner.kind == FrameOwner::DIRECTORY)
+        {
+            copyPage(dst, m_PageTableRoot >> 12);
+            m_PageTableRoot = dst << 12;
+            tlbFlush();
+            return;
+        }
+        uint32_t frame = *p >> 12;
+        copyPage(dst, frame);
+        *p = (dst << 12) | (*p & ~ADDR_MASK);
+        if (owner.kind == FrameOwner::TABLE)
+        {
+            tlbFlush();
+            return;
+        }
+        pageRefs[dst] = 1;
+        pageRefs[frame] = 0;
+        moveFrameSlot(frame, dst);
+        tlbInvalidate(owner.page << OFFSET_BITS);
+    }
+    // Counts the mappings of all the page tables, segments included. Without the guard the process
+    // may free a table meanwhile, its frame is then only checked to lie in the memory.
+    void collectStats(TMemMgrProcessStats& res) const
+    {
+        res.m_Cpu = this;
+        res.m_MemLimit = pagesLimit;
+        res.m_Resident = res.m_Swapped = 0;
+        res.m_PageTables = 1;
+        const uint32_t* dir = (const uint32_t*)(m_MemStart + m_PageTableRoot);
+        for (uint32_t d = 0; d < PAGE_DIR_ENTRIES; d++)
+        {
+            uint32_t entry = dir[d];
+            if (!(entry & BIT_PRESENT))
+                continue;
+            if (entry & BIT_LARGE)
+            {
+                res.m_Resident += PAGE_DIR_ENTRIES;
+                continue;
+            }
+            if ((entry >> 12) >= global_totalPages)
+                continue;
+            res.m_PageTables++;
+            const uint32_t* p = (const uint32_t*)(m_MemStart + (entry & ADDR_MASK));
+            for (uint32_t i = 0; i < PAGE_DIR_ENTRIES; i++)
+                if (p[i] & BIT_PRESENT)
+                    res.m_Resident++;
+                else if (p[i] & BIT_SWAPPED)
+                    res.m_Swapped++;
+        }
+        res.m_Faults = counters.faults.load(std::memory_order_relaxed);
+        res.m_DemandZero = counters.demandZero.load(std::memory_order_relaxed);
+        res.m_CowCopies = counters.cowCopies.load(std::memory_order_relaxed);
+        res.m_CowReuses = counters.cowReuses.load(std::memory_order_relaxed);
+        res.m_SwapIns = counters.swapIns.load(std::memory_order_relaxed);
+        res.m_Prefaulted = counters.prefaulted.load(std::memory_order_relaxed);
+        res.m_PrefaultHits = counters.prefaultHits.load(std::memory_order_relaxed);
+    }
+    // Replaces the mappings of frame by the swap slot, returns how many there were (or would be).
+    uint32_t unmapFrame(uint32_t frame, uint32_t slot, bool replace)
+    {
+        uint32_t res = 0;
+        for (uint32_t i = 0; i < pagesLimit; i++)
+        {
+            uint32_t* p = pageTableEntry(i);
+            if (!p)
+            {
+                i += PAGE_DIR_ENTRIES - 1 - i % PAGE_DIR_ENTRIES;
+                continue;
+            }
+            if (!(*p & BIT_PRESENT) || *p >> 12 != frame)
+                continue;
+            if (replace)
+            {
+                *p = (slot << 12) | BIT_SWAPPED;
+                tlbInvalidate(i << OFFSET_BITS);
+            }
+            res++;
+        }
+        return res;
+    }
+    friend bool reclaimPage(uint32_t& frame);
+    friend bool evictSharedPage(uint32_t& frame);
+    friend bool compactMemory(uint32_t wanted, uint32_t& freeLarge);
+    friend uint32_t compactLocked(uint32_t wanted);
+    friend bool evacuateChunk(uint32_t first, FrameOwner* owners);
+    friend TMemMgrStats MemMgrStats();
+    friend void * traceThread(void *);
+    friend bool dedupMerge(const DedupCandidate& c, CProcess* process, uint32_t page, uint32_t* p);
+    friend void dedupLocked(uint32_t budget);
+    friend bool dedupBatch(uint32_t budget);
+    friend uint32_t MemMgrDedup();
+
+    // processes the reclaimer may take pages from
+    static pthread_mutex_t processesLock;
+    static CProcess* processes;
+    static CProcess* clockProcess;
+    CProcess* prevProcess;
+    CProcess* nextProcess;
+public:
+    void registerProcess()
+    {
+        pthread_mutex_lock(&processesLock);
+        if (m_Trace)
+            m_Trace->m_Process = traceWriter.nextProcess++;
+        prevProcess = NULL;
+        nextProcess = processes;
+        if (processes)
+            processes->prevProcess = this;
+        processes = this;
+        pthread_mutex_unlock(&processesLock);
+    }
+    static void resetProcesses()
+    {
+        processes = clockProcess = NULL;
+    }
+private:
+    void unregisterProcess()
+    {
+        pthread_mutex_lock(&processesLock);
+        if (prevProcess)
+            prevProcess->nextProcess = nextProcess;
+        else
+            processes = nextProcess;
+        if (nextProcess)
+            nextProcess->prevProcess = prevProcess;
+        if (clockProcess == this)
+            clockProcess = nextProcess;
+        exitedCounters.add(counters);
+        if (m_Trace)
+            drainTrace(m_Trace);
+        pthread_mutex_unlock(&processesLock);
+    }
+    // Shared segments mapped into this process, each in page tables not used by [0, pagesLimit).
+    struct SegmentMapping
+    {
+        Segment* segment;
+        uint32_t firstPage;
+        SegmentMapping* next;
+    };
+    SegmentMapping* mappings = NULL;
+    // true if some mapping uses a page table that also covers a page of [from, to)
+    bool segmentTablesUsed(uint32_t from, uint32_t to, SegmentMapping* except = NULL)
+    {
+        for (SegmentMapping* m = mappings; m; m = m->next)
+            if (m != except
+                && m->firstPage / PAGE_DIR_ENTRIES <= (to - 1) / PAGE_DIR_ENTRIES
+                && from / PAGE_DIR_ENTRIES <= (m->firstPage + m->segment->pages - 1) / PAGE_DIR_ENTRIES)
+                return true;
+        return false;
+    }
+    bool mapSegment(int id, uint32_t address)
+    {
+        uint32_t first = address >> OFFSET_BITS;
+        if (address & ~ADDR_MASK || first < pageTables(pagesLimit) * PAGE_DIR_ENTRIES)
+            return false;
+        Segment* segment = acquireSegment(id);
+        if (!segment)
+            return false;
+        uint32_t end = first + segment->pages;
+        bool ok = end <= (1u << (32 - OFFSET_BITS)) && end > first;
+        for (SegmentMapping* m = mappings; m && ok; m = m->next)
+            ok = m->firstPage >= end || m->firstPage + m->segment->pages <= first;
+        uint32_t newTables = 0;
+        for (uint32_t t = first / PAGE_DIR_ENTRIES; ok && t <= (end - 1) / PAGE_DIR_ENTRIES; t++)
+            if (!(*pageDirEntry(t * PAGE_DIR_ENTRIES) & BIT_PRESENT))
+                newTables++;
+        if (!ok || !zarezervujDanyPocetStranek(newTables))
+        {
+            releaseSegment(segment);
+            return false;
+        }
+        for (uint32_t i = 0; i < segment->pages; i++)
+            *pageTableEntryAlloc(first + i) = (segment->frames[i] << 12) + BIT_SHARED + BIT_USER + BIT_WRITE + BIT_PRESENT;
+        mappings = new SegmentMapping{segment, first, mappings};
+        return true;
+    }
+    bool unmapSegment(uint32_t address)
+    {
+        SegmentMapping** prev = &mappings;
+        while (*prev && (*prev)->firstPage != address >> OFFSET_BITS)
+            prev = &(*prev)->next;
+        SegmentMapping* m = *prev;
+        if (!m || address & ~ADDR_MASK)
+            return false;
+        uint32_t end = m->firstPage + m->segment->pages;
+        for (uint32_t i = m->firstPage; i < end; i++)
+        {
+            *pageTableEntry(i) = 0;
+            tlbInvalidate(i << OFFSET_BITS);
+        }
+        // page tables no other mapping needs
+        for (uint32_t t = m->firstPage / PAGE_DIR_ENTRIES; t <= (end - 1) / PAGE_DIR_ENTRIES; t++)
+            if (!segmentTablesUsed(t * PAGE_DIR_ENTRIES, (t + 1) * PAGE_DIR_ENTRIES, m))
+            {
+                uint32_t* dir = pageDirEntry(t * PAGE_DIR_ENTRIES);
+                setPageAsFree(*dir >> 12, &magazine);
+                *dir = 0;
+            }
+        *prev = m->next;
+        releaseSegment(m->segment);
+        delete m;
+        return true;
+    }
+protected:
+    virtual bool             pageFaultHandler              ( uint32_t          address,
+                                                             bool              write )
+    {
+        uint32_t logicalPage = address >> OFFSET_BITS;
+        if (logicalPage >= pagesLimit)
+            return false;
+        FaultCounters::bump(counters.faults);
+        uint32_t* p = pageTableEntryAlloc(logicalPage, FAULT_RETRIES);
+        if (!p)
+            return false;
+        if (*p & BIT_SWAPPED)
+        {
+            if (!swapInPage(p))
+                return false;
+            faultAround(logicalPage);
+            return true;
+        }
+        if (!(*p & BIT_PRESENT))
+        {
+            // demand-zero, the quota was reserved by SetMemLimit
+            uint32_t page;
+            if (!getZeroedPage(&magazine, page, FAULT_RETRIES))
+                return false;
+            FaultCounters::bump(counters.demandZero);
+            pageRefs[page] = 1;
+            *p = (page << 12) + BIT_USER + BIT_WRITE + BIT_PRESENT;
+            faultAround(logicalPage);
+            return true;
+        }
+        if (write && (*p & BIT_COW))
+        {
+            tlbInvalidate(address);
+            return breakCow(p);
+        }
+        return false;
+    }
+public:
+    // m_PageTableRoot must be a zeroed page, quota is charged with it already and owned by the process
+    CProcess(uint8_t* m_MemStart, uint32_t m_PageTableRoot, Quota* quota)
+        : CCPU(m_MemStart, m_PageTableRoot), quota(quota)
+    {
+        pthread_mutex_init(&guard, NULL);
+        if (swapPages || memMgrConfig.m_Compaction || memMgrConfig.m_Dedup)
+            m_Guard = &guard;
+        registerMagazine(&magazine);
+        if (traceWriter.file)
+        {
+            m_Trace = new TTraceRing();
+            m_Trace->m_Size = TraceWriter::RING_RECORDS;
+            m_Trace->m_Records = new TTraceRecord[TraceWriter::RING_RECORDS];
+        }
+    }
+    virtual uint32_t         GetMemLimit                   ( void ) const
+    {
+         return pagesLimit;
+    }
+    virtual bool             SetMemLimit                   ( uint32_t          pages )
+    {
+        lockGuard();
+        bool res = setMemLimit(pages);
+        unlockGuard();
+        return res;
+    }
+    bool setMemLimit(uint32_t pages)
+    {
+        if (pages < pagesLimit)
+        {
+            releaseQuota(quota, pagesLimit - pages + pageTables(pagesLimit) - pageTables(pages));
+            shrink(pages);
+        }
+        else if (pages > pagesLimit && segmentTablesUsed(0, pages))
+            return false;
+        uint32_t zbyvaNaalokovat = pages - pagesLimit;
+        if (zbyvaNaalokovat == 0) return true;
+        zbyvaNaalokovat += pageTables(pages) - pageTables(pagesLimit);
+        if (!reserveQuota(quota, zbyvaNaalokovat))
+            return false;
+        if (zarezervujDanyPocetStranek(zbyvaNaalokovat))
+        {
+            if (memMgrConfig.m_LazyAlloc)
+            {
+                pagesLimit = pages;
+                return true;
+            }
+            if (pages - pagesLimit < PageMagazine::BATCH)
+            {
+                for (; pagesLimit < pages; )
+                {
+                    // the page table first: with overcommit, allocating may evict the pages mapped so far
+                    uint32_t* p = pageTableEntryAlloc(pagesLimit);
+                    uint32_t pagePhysicalIndex = getFreePage(&magazine);
+                    pageRefs[pagePhysicalIndex] = 1;
+                    *p = (pagePhysicalIndex << 12) | PAGE_FLAGS;
+                    pagesLimit++;
+                }
+                return true;
+            }
+            // large growth: the rest of a page table at a time, allocated under one lock
+            uint32_t run[PAGE_DIR_ENTRIES];
+            bool compact = memMgrConfig.m_Compaction;
+            while (pagesLimit < pages)
+            {
+                // a whole 4 MiB region maps to one large page if an aligned free run exists, or if
+                // compaction (at most once per call) makes one
+                uint32_t base;
+                if (memMgrConfig.m_LargePages && !swapPages && pagesLimit % PAGE_DIR_ENTRIES == 0
+                    && pages - pagesLimit >= PAGE_DIR_ENTRIES && !(*pageDirEntry(pagesLimit) & BIT_PRESENT)
+                    && (getFreeLargePage(base) || (compact && compactOnce(base, compact))))
+                {
+                    *pageDirEntry(pagesLimit) = (base << 12) | BIT_LARGE | PAGE_FLAGS;
+                    pagesLimit += PAGE_DIR_ENTRIES;
+                    continue;
+                }
+                uint32_t n = PAGE_DIR_ENTRIES - pagesLimit % PAGE_DIR_ENTRIES;
+                if (n > pages - pagesLimit)
+                    n = pages - pagesLimit;
+                uint32_t* p = pageTableEntryAlloc(pagesLimit);
+                n = getFreePages(run, n, &magazine);
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    pageRefs[run[i]] = 1;
+                    p[i] = (run[i] << 12) | PAGE_FLAGS;
+                }
+                pagesLimit += n;
+            }
+            return true;
+        }
+        releaseQuota(quota, zbyvaNaalokovat);
+        return false;
+    }
+    virtual bool NewProcess(
+        void * processArg,
+        void (* entryPoint) ( CCPU *, void * ),
+        bool copyMem
+    )
+    {
+        lockGuard();
+        bool res = newProcess(processArg, entryPoint, copyMem);
+        unlockGuard();
+        return res;
+    }
+    // a few attempts, another process may be in the middle of a memory access
+    bool compactOnce(uint32_t& base, bool& compact)
+    {
+        uint32_t freeLarge = 0;
+        compact = false;
+        for (int attempt = 0; attempt < 16 && !compactMemory(1, freeLarge); attempt++)
+            sched_yield();
+        return freeLarge && getFreeLargePage(base);
+    }
+    bool newProcess(void * processArg, void (* entryPoint) ( CCPU *, void * ), bool copyMem)
+    {
+        // with copyMem, the data pages are shared copy-on-write, only the page tables are new
+        // (and with cowReserve a page for the copy of every shared page, so that a write never fails);
+        // the child's sub-quota is charged with its whole memory limit
+        uint32_t zarezervovat = 1;
+        if (copyMem)
+            zarezervovat += pageTables(pagesLimit) + (cowReserve ? pagesLimit : absentPages());
+        Quota* childQuota = newQuota(quota);
+        uint32_t committed = 1 + (copyMem ? pagesLimit + pageTables(pagesLimit) : 0);
+        if (!reserveQuota(childQuota, committed))
+        {
+            dropQuota(childQuota);
+            return false;
+        }
+        if (zarezervujDanyPocetStranek(zarezervovat)) {
+            auto *process = new CProcess(m_MemStart, 4096 * getFreePageDir(), childQuota);
+            if (copyMem)
+                process->shareMemory(*this);
+            process->registerProcess();
+            startProcess(new NewProcessData{processArg, (CCPU *) process, entryPoint, NULL});
+            return true;
+        }
+        releaseQuota(childQuota, committed);
+        dropQuota(childQuota);
+        return false;
+    }
+    virtual bool             SetQuota                      ( uint32_t          pages )
+    {
+        uint32_t old = quota->limit.exchange(pages);
+        // a concurrent reservation has seen the old limit, or the new one
+        if (pages && quota->committed.load() > pages)
+        {
+            quota->limit = old;
+            return false;
+        }
+        return true;
+    }
+    virtual int              CreateSegment                 ( uint32_t          pages )
+    {
+        lockGuard();
+        int res = createSegment(pages, &magazine);
+        unlockGuard();
+        return res;
+    }
+    virtual bool             ReleaseSegment                ( int               id )
+    {
+        return releaseSegmentId(id);
+    }
+    virtual bool             MapSegment                    ( int               id,
+                                                             uint32_t          address )
+    {
+        lockGuard();
+        bool res = mapSegment(id, address);
+        unlockGuard();
+        return res;
+    }
+    virtual bool             UnmapSegment                  ( uint32_t          address )
+    {
+        lockGuard();
+        bool res = unmapSegment(address);
+        unlockGuard();
+        return res;
+    }
+    virtual ~CProcess()
+    {
+        unregisterProcess();
+        while (mappings)
+            UnmapSegment(mappings->firstPage << OFFSET_BITS);
+        SetMemLimit(0);
+        setPageAsFree(m_PageTableRoot >> 12, &magazine);
+        releaseQuota(quota, 1);
+        dropQuota(quota);
+        unregisterMagazine(&magazine);
+        pthread_mutex_destroy(&guard);
+        if (m_Trace)
+        {
+            delete[] m_Trace->m_Records;
+            delete m_Trace;
+        }
+    }
+};
+
+pthread_mutex_t CProcess::processesLock = PTHREAD_MUTEX_INITIALIZER;
+CProcess* CProcess::processes;
+CProcess* CProcess::clockProcess;
+
+// Evicts a page shared copy-on-write from all processes that map it at once, they end up
+// sharing the swap slot. Needs the guards of all processes, gives up if any is busy, or if
+// some mapping is out of reach (a child process being set up by NewProcess).
+bool evictSharedPage(uint32_t& frame)
+{
+    CProcess* locked = NULL;
+    bool ok = true;
+    for (CProcess* p = CProcess::processes; p && ok; p = p->nextProcess)
+        if (p != currentProcess && !(ok = pthread_mutex_trylock(&p->guard) == 0))
+            locked = p;
+    uint32_t victim = ~0u;
+    for (CProcess* p = CProcess::processes; p && ok && victim == ~0u; p = p->nextProcess)
+        victim = p->findSharedPage();
+    bool res = false;
+    if (ok && victim != ~0u)
+    {
+        uint32_t mappings = 0;
+        for (CProcess* p = CProcess::processes; p; p = p->nextProcess)
+            mappings += p->unmapFrame(victim, 0, false);
+        uint32_t slot;
+        if (mappings == pageRefs[victim].load() && swapOut(victim, true, slot))
+        {
+            for (CProcess* p = CProcess::processes; p; p = p->nextProcess)
+                p->unmapFrame(victim, slot, true);
+            shareSlot(slot, mappings - 1);
+            pageRefs[victim] = 0;
+            frame = victim;
+            res = true;
+        }
+    }
+    for (CProcess* p = CProcess::processes; p != locked; p = p->nextProcess)
+        if (p != currentProcess)
+            pthread_mutex_unlock(&p->guard);
+    return res;
+}
+
+// Round robin over the processes, one eviction each. Shared pages are evicted only when
+// no process has a private page to give. The guard of the current process is held by
+// this thread already, the other processes are skipped while they access their memory.
+bool reclaimPage(uint32_t& frame)
+{
+    pthread_mutex_lock(&CProcess::processesLock);
+    uint32_t n = 0;
+    for (CProcess* p = CProcess::processes; p; p = p->nextProcess)
+        n++;
+    bool res = false;
+    for (uint32_t i = 0; i < n && !res; i++)
+    {
+        if (!CProcess::clockProcess)
+            CProcess::clockProcess = CProcess::processes;
+        CProcess* p = CProcess::clockProcess;
+        CProcess::clockProcess = p->nextProcess;
+        bool self = p == currentProcess;
+        if (!self && pthread_mutex_trylock(&p->guard) != 0)
+            continue;
+        res = p->evictPage(frame);
+        if (!self)
+            pthread_mutex_unlock(&p->guard);
+    }
+    if (!res)
+        res = evictSharedPage(frame);
+    pthread_mutex_unlock(&CProcess::processesLock);
+    return res;
+}
+
+// Empties the aligned 1024-page chunk at first: its free blocks are taken out of the buddy
+// allocator, the pages in use are migrated to free blocks smaller than a large page, then the
+// chunk is freed as a whole. False (the chunk stays as it was, or partly migrated) when a page
+// of the chunk is neither free nor movable any more, or when there are no free blocks to
+// migrate to.
+bool evacuateChunk(uint32_t first, FrameOwner* owners)
+{
+    const uint32_t LARGE = BuddyAllocator::ORDERS - 1;
+    uint32_t used = 0;
+    for (uint32_t i = first; i < first + CCPU::PAGE_DIR_ENTRIES; i++)
+        if (owners[i].process)
+            used++;
+    lockGlobal();
+    // the zero pool thread or an exiting process may have changed the chunk since the scan
+    uint32_t free = 0;
+    for (uint32_t i = first; i < first + CCPU::PAGE_DIR_ENTRIES; i++)
+        if (freePages.isFree(i))
+            free++;
+    if (free + used != CCPU::PAGE_DIR_ENTRIES)
+    {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    freePages.claim(first, LARGE);
+    pthread_mutex_unlock(&lock);
+
+    uint32_t i = first;
+    uint32_t migrated = 0;
+    for (; i < first + CCPU::PAGE_DIR_ENTRIES; i++)
+    {
+        FrameOwner& owner = owners[i];
+        if (!owner.process)
+            continue;
+        uint32_t dst;
+        lockGlobal();
+        bool ok = freePages.take(0, dst, LARGE - 1);
+        if (ok)
+        {
+            nPouzitychStranek++;
+            nPresunutychStranek++;
+        }
+        pthread_mutex_unlock(&lock);
+        if (!ok)
+            break;
+        owner.process->migratePage(owner, dst);
+        owners[dst] = owner;
+        owner.process = NULL;
+        migrated++;
+    }
+    lockGlobal();
+    if (i == first + CCPU::PAGE_DIR_ENTRIES)
+        freePages.release(first, LARGE);
+    else
+        for (uint32_t j = first; j < first + CCPU::PAGE_DIR_ENTRIES; j++)
+            if (!owners[j].process)
+                freePages.release(j);
+    nUvolnenychStranek += migrated;
+    pthread_mutex_unlock(&lock);
+    return i == first + CCPU::PAGE_DIR_ENTRIES;
+}
+
+// One compaction pass with all the processes stopped. The chunks with only free and movable
+// pages are evacuated, the ones with the fewest pages in use first, until there are wanted free
+// large blocks. The owners of the pages come from a reverse map built by walking the page tables.
+// Returns the number of free large blocks.
+uint32_t compactLocked(uint32_t wanted)
+{
+    const uint32_t LARGE = BuddyAllocator::ORDERS - 1;
+    uint32_t chunks = global_totalPages / CCPU::PAGE_DIR_ENTRIES;
+    FrameOwner* owners = new FrameOwner[global_totalPages]();
+    for (CProcess* p = CProcess::processes; p; p = p->nextProcess)
+        p->collectOwners(owners);
+    // candidates sorted by the pages in use
+    uint32_t* order = new uint32_t[chunks];
+    uint32_t* used = new uint32_t[chunks];
+    uint32_t nCandidates = 0;
+    lockGlobal();
+    drainMagazines();
+    uint32_t res = freePages.freeBlocks(LARGE);
+    for (uint32_t c = 0; c < chunks; c++)
+    {
+        uint32_t first = c * CCPU::PAGE_DIR_ENTRIES;
+        if (freePages.isFree(first, LARGE))
+            continue;
+        uint32_t n = 0;
+        bool movable = true;
+        for (uint32_t i = first; i < first + CCPU::PAGE_DIR_ENTRIES && movable; i++)
+            if (!freePages.isFree(i))
+            {
+                movable = owners[i].process != NULL;
+                n++;
+            }
+        if (!movable)
+            continue;
+        uint32_t k = nCandidates++;
+        for (; k && used[order[k - 1]] > n; k--)
+            order[k] = order[k - 1];
+        order[k] = c;
+        used[c] = n;
+    }
+    pthread_mutex_unlock(&lock);
+    for (uint32_t i = 0; i < nCandidates && res < wanted; i++)
+        if (evacuateChunk(order[i] * CCPU::PAGE_DIR_ENTRIES, owners))
+            res++;
+    delete[] owners;
+    delete[] order;
+    delete[] used;
+    return res;
+}
+
+// Stops all the processes (the guard of the current one is held by this thread already) and
+// runs a compaction pass. False if a process is in the middle of a memory access.
+bool compactMemory(uint32_t wanted, uint32_t& freeLarge)
+{
+    pthread_mutex_lock(&CProcess::processesLock);
+    CProcess* locked = NULL;
+    bool ok = true;
+    for (CProcess* p = CProcess::processes; p && ok; p = p->nextProcess)
+        if (p != currentProcess && !(ok = pthread_mutex_trylock(&p->guard) == 0))
+            locked = p;
+    if (ok)
+        freeLarge = compactLocked(wanted);
+    for (CProcess* p = CProcess::processes; p != locked; p = p->nextProcess)
+        if (p != currentProcess)
+            pthread_mutex_unlock(&p->guard);
+    pthread_mutex_unlock(&CProcess::processesLock);
+    return ok;
+}
+
+uint32_t MemMgrCompact()
+{
+    uint32_t res = 0;
+    if (!memMgrConfig.m_Compaction)
+        return res;
+    while (!compactMemory(~0u, res))
+        sched_yield();
+    return res;
+}
+
+// Same-page merging (TMemMgrConfig::m_Dedup). A cursor walks the pages of the processes, a batch
+// at a time with all of them stopped. A page whose hash has not changed since the previous sweep
+// (a page being written is not worth merging) is looked up among the pages hashed so far in this
+// sweep; when an identical one is found, both are mapped read-only copy-on-write to its frame and
+// the frame of the page is freed with its last mapping. The mapping stays charged (cowReserve), a
+// write breaks the sharing in pageFaultHandler as after NewProcess and the copy takes that charge
+// over. Compaction does not move the merged (shared) pages.
+struct DedupCandidate
+{
+    uint64_t hash;
+    CProcess* process;  // NULL = empty slot
+    uint32_t page;
+    uint32_t frame;
+};
+
+struct Dedup
+{
+    uint32_t* checksums;  // of each frame, from the previous sweep
+    DedupCandidate* table;  // open addressing, mask + 1 slots, emptied by each new sweep
+    uint32_t mask;
+    uint32_t used;
+    CProcess* cursor;  // NULL = the next batch starts a new sweep
+    uint32_t cursorPage;
+    uint64_t sweeps;
+    // under CProcess::processesLock
+    uint64_t scanned;
+    uint64_t merged;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint32_t rate;
+    bool stop;
+} dedup;
+
+uint64_t hashPage(uint32_t frame)
+{
+    const uint64_t* w = (const uint64_t*)(memStart + (size_t) frame * CCPU::PAGE_SIZE);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < CCPU::PAGE_SIZE / sizeof(uint64_t); i++)
+        h = (h ^ w[i]) * 0x100000001b3ull;
+    return h ^ (h >> 32);
+}
+
+// Merges the page at page of process (p is its entry) into the frame of the candidate. False if
+// the candidate is gone or not identical, it is then replaced by the page.
+bool dedupMerge(const DedupCandidate& c, CProcess* process, uint32_t page, uint32_t* p)
+{
+    bool found = false;
+    for (CProcess* q = CProcess::processes; q && !found; q = q->nextProcess)
+        found = q == c.process;
+    uint32_t* e = found && c.page < c.process->pagesLimit ? c.process->pageTableEntry(c.page) : NULL;
+    if (!e || !(*e & CProcess::BIT_PRESENT) || (*e & CProcess::BIT_SHARED) || *e >> 12 != c.frame
+        || c.page == c.process->m_Pinned)
+        return false;
+    uint32_t frame = *p >> 12;
+    // shared already, or the candidate has as many mappings as the reference count can take
+    if (frame == c.frame || pageRefs[c.frame].load() >= 0xff00)
+        return true;
+    if (memcmp(memStart + (size_t) frame * CCPU::PAGE_SIZE, memStart + (size_t) c.frame * CCPU::PAGE_SIZE,
+               CCPU::PAGE_SIZE))
+        return false;
+    if (!(*e & CProcess::BIT_COW))
+    {
+        *e = (*e & ~CCPU::BIT_WRITE) | CProcess::BIT_COW;
+        c.process->tlbInvalidate(c.page << CCPU::OFFSET_BITS);
+    }
+    pageRefs[c.frame]++;
+    *p = (c.frame << 12) | (*p & ~CCPU::ADDR_MASK & ~CCPU::BIT_WRITE) | CProcess::BIT_COW;
+    process->tlbInvalidate(page << CCPU::OFFSET_BITS);
+    // a frame shared after NewProcess is freed only when all its mappings have been merged
+    if (pageRefs[frame].fetch_sub(1) == 1)
+    {
+        releaseFrameSlot(frame);
+        setPageAsFree(frame, NULL, false);
+        dedup.merged++;
+    }
+    return true;
+}
+
+// Examines up to budget pages, all the processes are stopped and CProcess::processesLock is held.
+// Segment pages, large pages, swapped pages and the page CopyBlock has pinned are skipped.
+void dedupLocked(uint32_t budget)
+{
+    bool found = false;
+    for (CProcess* q = CProcess::processes; q && !found; q = q->nextProcess)
+        found = q == dedup.cursor;
+    if (!found)
+    {
+        // a new sweep, or the process under the cursor has finished
+        dedup.cursor = CProcess::processes;
+        dedup.cursorPage = 0;
+    }
+    while (budget && dedup.cursor)
+    {
+        CProcess* process = dedup.cursor;
+        if (dedup.cursorPage >= process->pagesLimit)
+        {
+            dedup.cursor = process->nextProcess;
+            dedup.cursorPage = 0;
+            if (!dedup.cursor)
+            {
+                memset(dedup.table, 0, (dedup.mask + 1) * sizeof(*dedup.table));
+                dedup.used = 0;
+                dedup.sweeps++;
+            }
+            continue;
+        }
+        uint32_t i = dedup.cursorPage++;
+        budget--;
+        uint32_t* p = process->pageTableEntry(i);
+        if (!p)
+        {
+            dedup.cursorPage += CCPU::PAGE_DIR_ENTRIES - 1 - i % CCPU::PAGE_DIR_ENTRIES;
+            continue;
+        }
+        if (!(*p & CCPU::BIT_PRESENT) || (*p & CProcess::BIT_SHARED) || i == process->m_Pinned)
+            continue;
+        dedup.scanned++;
+        uint32_t frame = *p >> 12;
+        uint64_t hash = hashPage(frame);
+        bool stable = dedup.checksums[frame] == (uint32_t) hash;
+        dedup.checksums[frame] = (uint32_t) hash;
+        if (!stable)
+            continue;
+        uint32_t slot = hash & dedup.mask;
+        while (dedup.table[slot].process && dedup.table[slot].hash != hash)
+            slot = (slot + 1) & dedup.mask;
+        DedupCandidate& c = dedup.table[slot];
+        if (c.process ? dedupMerge(c, process, i, p) : dedup.used >= dedup.mask / 2)
+            continue;
+        dedup.used += !c.process;
+        c = DedupCandidate{hash, process, i, frame};
+    }
+}
+
+// Stops all the processes (the guard of the current one is held by this thread already) and
+// examines up to budget pages. False if a process is in the middle of a memory access.
+bool dedupBatch(uint32_t budget)
+{
+    pthread_mutex_lock(&CProcess::processesLock);
+    CProcess* locked = NULL;
+    bool ok = true;
+    for (CProcess* p = CProcess::processes; p && ok; p = p->nextProcess)
+        if (p != currentProcess && !(ok = pthread_mutex_trylock(&p->guard) == 0))
+            locked = p;
+    if (ok)
+        dedupLocked(budget);
+    for (CProcess* p = CProcess::processes; p != locked; p = p->nextProcess)
+        if (p != currentProcess)
+            pthread_mutex_unlock(&p->guard);
+    pthread_mutex_unlock(&CProcess::processesLock);
+    return ok;
+}
+
+uint32_t MemMgrDedup()
+{
+    if (!dedup.table)
+        return 0;
+    pthread_mutex_lock(&CProcess::processesLock);
+    uint64_t merged = dedup.merged;
+    // the sweep in progress has not seen all the pages yet, the next one records their hashes,
+    // the one after it merges
+    uint64_t last = dedup.sweeps + (dedup.cursor ? 3 : 2);
+    pthread_mutex_unlock(&CProcess::processesLock);
+    for (;;)
+    {
+        pthread_mutex_lock(&CProcess::processesLock);
+        bool done = dedup.sweeps >= last;
+        pthread_mutex_unlock(&CProcess::processesLock);
+        if (done)
+            break;
+        if (!dedupBatch(4096))
+            sched_yield();
+    }
+    pthread_mutex_lock(&CProcess::processesLock);
+    merged = dedup.merged - merged;
+    pthread_mutex_unlock(&CProcess::processesLock);
+    return merged;
+}
+
+// Background merging, a batch of m_DedupScanRate / 100 pages every 10 ms. The batch is skipped
+// while a process is accessing its memory.
+void * dedupThread(void *)
+{
+    uint32_t budget = dedup.rate / 100 ? dedup.rate / 100 : 1;
+    pthread_mutex_lock(&dedup.lock);
+    while (!dedup.stop)
+    {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 10000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        if (pthread_cond_timedwait(&dedup.cond, &dedup.lock, &deadline) == 0)
+            continue;
+        pthread_mutex_unlock(&dedup.lock);
+        dedupBatch(budget);
+        pthread_mutex_lock(&dedup.lock);
+    }
+    pthread_mutex_unlock(&dedup.lock);
+    return NULL;
+}
+
+void startDedup(const TMemMgrConfig& config, uint32_t totalPages)
+{
+    dedup.scanned = dedup.merged = dedup.sweeps = 0;
+    dedup.cursor = NULL;
+    dedup.rate = 0;
+    dedup.checksums = NULL;
+    dedup.table = NULL;
+    if (!config.m_Dedup)
+        return;
+    dedup.checksums = new uint32_t[totalPages]();
+    uint32_t slots = 1;
+    while (slots < 2 * totalPages)
+        slots <<= 1;
+    dedup.mask = slots - 1;
+    dedup.used = 0;
+    dedup.table = new DedupCandidate[slots]();
+    dedup.rate = config.m_DedupScanRate;
+    if (!dedup.rate)
+        return;
+    dedup.stop = false;
+    pthread_mutex_init(&dedup.lock, NULL);
+    pthread_cond_init(&dedup.cond, NULL);
+    pthread_create(&dedup.thread, NULL, dedupThread, NULL);
+}
+
+// the counters stay for MemMgrStats after MemMgr
+void stopDedup()
+{
+    if (!dedup.table)
+        return;
+    if (dedup.rate)
+    {
+        pthread_mutex_lock(&dedup.lock);
+        dedup.stop = true;
+        pthread_cond_signal(&dedup.cond);
+        pthread_mutex_unlock(&dedup.lock);
+        pthread_join(dedup.thread, NULL);
+        pthread_cond_destroy(&dedup.cond);
+        pthread_mutex_destroy(&dedup.lock);
+    }
+    delete[] dedup.checksums;
+    delete[] dedup.table;
+    dedup.checksums = NULL;
+    dedup.table = NULL;
+}
+
+// The page tables of a process are walked while it is stopped, a process that is in the middle of
+// a memory access (or has no guard) is walked as it is. Neither the global lock nor the guards are
+// ever waited for with another lock held.
+TMemMgrStats MemMgrStats()
+{
+    TMemMgrStats res = TMemMgrStats();
+    res.m_TotalPages = global_totalPages;
+    res.m_SwapPages = swapPages;
+    uint32_t cached = 0;
+    if (zeroPool.size)
+    {
+        pthread_mutex_lock(&zeroPool.lock);
+        cached = zeroPool.count;
+        pthread_mutex_unlock(&zeroPool.lock);
+    }
+    // not by lockGlobal, the snapshot does not show up in the lock statistics
+    pthread_mutex_lock(&lock);
+    for (uint32_t o = 0; o < BuddyAllocator::ORDERS; o++)
+        res.m_FreePages += freePages.freeBlocks(o) << o;
+    // the magazines may be changing, their counts are read without their locks
+    for (PageMagazine* mag = magazines; mag; mag = mag->next)
+        cached += __atomic_load_n(&mag->count, __ATOMIC_RELAXED);
+    res.m_AllocatedPages = nPouzitychStranek;
+    res.m_FreedPages = nUvolnenychStranek;
+    res.m_LockAcquisitions = nLockAcquisitions;
+    res.m_LockContended = nLockContended;
+    res.m_LockWaitNs = nLockWaitNs;
+    pthread_mutex_unlock(&lock);
+    res.m_CachedPages = cached;
+    res.m_UsedPages = res.m_TotalPages - res.m_FreePages - cached;
+    res.m_ReservedPages = nRezervovanychStranek.load();
+
+    pthread_mutex_lock(&CProcess::processesLock);
+    res.m_Faults = exitedCounters.faults;
+    res.m_DemandZero = exitedCounters.demandZero;
+    res.m_CowCopies = exitedCounters.cowCopies;
+    res.m_CowReuses = exitedCounters.cowReuses;
+    res.m_SwapIns = exitedCounters.swapIns;
+    res.m_Prefaulted = exitedCounters.prefaulted;
+    res.m_PrefaultHits = exitedCounters.prefaultHits;
+    res.m_DedupScanned = dedup.scanned;
+    res.m_DedupMerged = dedup.merged;
+    for (CProcess* p = CProcess::processes; p && res.m_Processes < PROCESS_MAX; p = p->nextProcess)
+    {
+        bool stopped = p != currentProcess && p->m_Guard && pthread_mutex_trylock(p->m_Guard) == 0;
+        TMemMgrProcessStats& proc = res.m_Process[res.m_Processes++];
+        p->collectStats(proc);
+        if (stopped)
+            pthread_mutex_unlock(p->m_Guard);
+        res.m_Faults += proc.m_Faults;
+        res.m_DemandZero += proc.m_DemandZero;
+        res.m_CowCopies += proc.m_CowCopies;
+        res.m_CowReuses += proc.m_CowReuses;
+        res.m_SwapIns += proc.m_SwapIns;
+        res.m_Prefaulted += proc.m_Prefaulted;
+        res.m_PrefaultHits += proc.m_PrefaultHits;
+    }
+    pthread_mutex_unlock(&CProcess::processesLock);
+    return res;
+}
+
+void MemMgrStatsDump(FILE* fp, const TMemMgrStats& stats, bool json)
+{
+    if (json)
+    {
+        fprintf(fp, "{\"total\":%u,\"free\":%u,\"cached\":%u,\"used\":%u,\"reserved\":%u,\"swap\":%u,"
+                "\"allocated\":%llu,\"freed\":%llu,\"lock\":{\"acquisitions\":%llu,\"contended\":%llu,\"wait_ns\":%llu},"
+                "\"faults\":%llu,\"demand_zero\":%llu,\"cow_copies\":%llu,\"cow_reuses\":%llu,\"swap_ins\":%llu,"
+                "\"prefaulted\":%llu,\"prefault_hits\":%llu,\"dedup_scanned\":%llu,\"dedup_merged\":%llu,\"processes\":[",
+                stats.m_TotalPages, stats.m_FreePages, stats.m_CachedPages, stats.m_UsedPages, stats.m_ReservedPages,
+                stats.m_SwapPages, (unsigned long long) stats.m_AllocatedPages, (unsigned long long) stats.m_FreedPages,
+                (unsigned long long) stats.m_LockAcquisitions, (unsigned long long) stats.m_LockContended,
+                (unsigned long long) stats.m_LockWaitNs, (unsigned long long) stats.m_Faults,
+                (unsigned long long) stats.m_DemandZero, (unsigned long long) stats.m_CowCopies,
+                (unsigned long long) stats.m_CowReuses, (unsigned long long) stats.m_SwapIns,
+                (unsigned long long) stats.m_Prefaulted, (unsigned long long) stats.m_PrefaultHits,
+                (unsigned long long) stats.m_DedupScanned, (unsigned long long) stats.m_DedupMerged);
+        for (uint32_t i = 0; i < stats.m_Processes; i++)
+        {
+            const TMemMgrProcessStats& p = stats.m_Process[i];
+            fprintf(fp, "%s{\"limit\":%u,\"resident\":%u,\"swapped\":%u,\"page_tables\":%u,\"faults\":%llu,"
+                    "\"demand_zero\":%llu,\"cow_copies\":%llu,\"cow_reuses\":%llu,\"swap_ins\":%llu,"
+                    "\"prefaulted\":%llu,\"prefault_hits\":%llu}",
+                    i ? "," : "", p.m_MemLimit, p.m_Resident, p.m_Swapped, p.m_PageTables,
+                    (unsigned long long) p.m_Faults, (unsigned long long) p.m_DemandZero,
+                    (unsigned long long) p.m_CowCopies, (unsigned long long) p.m_CowReuses,
+                    (unsigned long long) p.m_SwapIns, (unsigned long long) p.m_Prefaulted,
+                    (unsigned long long) p.m_PrefaultHits);
+        }
+        fprintf(fp, "]}\n");
+        return;
+    }
+    fprintf(fp, "pages: total %u, free %u, cached %u, used %u, reserved %u, swap %u\n",
+            stats.m_TotalPages, stats.m_FreePages, stats.m_CachedPages, stats.m_UsedPages,
+            stats.m_ReservedPages, stats.m_SwapPages);
+    fprintf(fp, "allocated %llu, freed %llu, lock: %llu acquisitions, %llu contended, %.3f ms waiting\n",
+            (unsigned long long) stats.m_AllocatedPages, (unsigned long long) stats.m_FreedPages,
+            (unsigned long long) stats.m_LockAcquisitions, (unsigned long long) stats.m_LockContended,
+            stats.m_LockWaitNs / 1e6);
+    fprintf(fp, "faults %llu: demand-zero %llu, cow copies %llu, cow reuses %llu, swap-ins %llu\n",
+            (unsigned long long) stats.m_Faults, (unsigned long long) stats.m_DemandZero,
+            (unsigned long long) stats.m_CowCopies, (unsigned long long) stats.m_CowReuses,
+            (unsigned long long) stats.m_SwapIns);
+    fprintf(fp, "fault-around: %llu pages populated ahead, %llu of them used\n",
+            (unsigned long long) stats.m_Prefaulted, (unsigned long long) stats.m_PrefaultHits);
+    fprintf(fp, "same-page merging: %llu pages scanned, %llu frames freed\n",
+            (unsigned long long) stats.m_DedupScanned, (unsigned long long) stats.m_DedupMerged);
+    fprintf(fp, "%-6s %8s %8s %8s %6s %10s %10s %10s %10s %10s %10s\n", "proc", "limit", "resident", "swapped",
+            "tables", "faults", "zero", "cow-copy", "cow-reuse", "swap-in", "prefault");
+    for (uint32_t i = 0; i < stats.m_Processes; i++)
+    {
+        const TMemMgrProcessStats& p = stats.m_Process[i];
+        fprintf(fp, "%-6u %8u %8u %8u %6u %10llu %10llu %10llu %10llu %10llu %10llu\n", i, p.m_MemLimit,
+                p.m_Resident, p.m_Swapped, p.m_PageTables, (unsigned long long) p.m_Faults,
+                (unsigned long long) p.m_DemandZero, (unsigned long long) p.m_CowCopies,
+                (unsigned long long) p.m_CowReuses, (unsigned long long) p.m_SwapIns,
+                (unsigned long long) p.m_Prefaulted);
+    }
+}
+
+// Background compaction, a pass every m_CompactIntervalMs. The pass is skipped while a process
+// is accessing its memory.
+struct CompactDaemon
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint32_t intervalMs;
+    bool stop;
+} compactDaemon;
+
+void * compactThread(void *)
+{
+    pthread_mutex_lock(&compactDaemon.lock);
+    while (!compactDaemon.stop)
+    {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long) (compactDaemon.intervalMs % 1000) * 1000000;
+        deadline.tv_sec += compactDaemon.intervalMs / 1000 + deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        if (pthread_cond_timedwait(&compactDaemon.cond, &compactDaemon.lock, &deadline) == 0)
+            continue;
+        pthread_mutex_unlock(&compactDaemon.lock);
+        uint32_t freeLarge;
+        compactMemory(~0u, freeLarge);
+        pthread_mutex_lock(&compactDaemon.lock);
+    }
+    pthread_mutex_unlock(&compactDaemon.lock);
+    return NULL;
+}
+
+void startCompactDaemon(const TMemMgrConfig& config)
+{
+    compactDaemon.intervalMs = config.m_Compaction ? config.m_CompactIntervalMs : 0;
+    if (!compactDaemon.intervalMs)
+        return;
+    compactDaemon.stop = false;
+    pthread_mutex_init(&compactDaemon.lock, NULL);
+    pthread_cond_init(&compactDaemon.cond, NULL);
+    pthread_create(&compactDaemon.thread, NULL, compactThread, NULL);
+}
+
+void stopCompactDaemon()
+{
+    if (!compactDaemon.intervalMs)
+        return;
+    pthread_mutex_lock(&compactDaemon.lock);
+    compactDaemon.stop = true;
+    pthread_cond_signal(&compactDaemon.cond);
+    pthread_mutex_unlock(&compactDaemon.lock);
+    pthread_join(compactDaemon.thread, NULL);
+    pthread_cond_destroy(&compactDaemon.cond);
+    pthread_mutex_destroy(&compactDaemon.lock);
+}
+
+// Drains the rings every millisecond, or right away again while they keep filling.
+void * traceThread(void *)
+{
+    pthread_mutex_lock(&traceWriter.lock);
+    while (!traceWriter.stop)
+    {
+        pthread_mutex_unlock(&traceWriter.lock);
+        uint32_t n = 0;
+        pthread_mutex_lock(&CProcess::processesLock);
+        for (CProcess* p = CProcess::processes; p; p = p->nextProcess)
+            n += drainTrace(p->m_Trace);
+        pthread_mutex_unlock(&CProcess::processesLock);
+        pthread_mutex_lock(&traceWriter.lock);
+        if (n || traceWriter.stop)
+            continue;
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&traceWriter.cond, &traceWriter.lock, &deadline);
+    }
+    pthread_mutex_unlock(&traceWriter.lock);
+    return NULL;
+}
+
+void startTrace(const TMemMgrConfig& config)
+{
+    traceWriter.file = config.m_TraceFile ? fopen(config.m_TraceFile, "wb") : NULL;
+    if (!traceWriter.file)
+        return;
+    fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, traceWriter.file);
+    traceWriter.nextProcess = 0;
+    traceWriter.stop = false;
+    pthread_mutex_init(&traceWriter.lock, NULL);
+    pthread_cond_init(&traceWriter.cond, NULL);
+    pthread_create(&traceWriter.thread, NULL, traceThread, NULL);
+}
+
+// the processes are gone, their rings have been drained by unregisterProcess
+void stopTrace()
+{
+    if (!traceWriter.file)
+        return;
+    pthread_mutex_lock(&traceWriter.lock);
+    traceWriter.stop = true;
+    pthread_cond_signal(&traceWriter.cond);
+    pthread_mutex_unlock(&traceWriter.lock);
+    pthread_join(traceWriter.thread, NULL);
+    pthread_cond_destroy(&traceWriter.cond);
+    pthread_mutex_destroy(&traceWriter.lock);
+    fclose(traceWriter.file);
+    traceWriter.file = NULL;
+}
+
+void MemMgr( void * mem,
+    uint32_t totalPages,
+    void * processArg,
+    void (* mainProcess) ( CCPU *, void * )
+)
+{
+    nPouzitychStranek = 0;
+    nUvolnenychStranek = 0;
+    nRezervovanychStranek = 1;
+    nPresunutychStranek = 0;
+    nLockAcquisitions = 0;
+    nLockContended = 0;
+    nLockWaitNs = 0;
+    exitedCounters.clear();
+    magazines = NULL;
+    global_totalPages = totalPages;
+    freePages.init(totalPages);
+    delete[] pageRefs;
+    pageRefs = new std::atomic<uint16_t>[totalPages];
+    memStart = (uint8_t*) mem;
+    startSwap(memMgrConfig, totalPages);
+    // a merged page keeps the charge of its mapping, as a page shared by NewProcess does with m_CowReserve
+    cowReserve = memMgrConfig.m_CowReserve || memMgrConfig.m_Dedup;
+    CProcess::resetProcesses();
+    startZeroPool(memMgrConfig.m_ZeroPoolPages);
+    startCompactDaemon(memMgrConfig);
+    startDedup(memMgrConfig, totalPages);
+    startTrace(memMgrConfig);
+    Quota* initQuota = newQuota(NULL);
+    reserveQuota(initQuota, 1);
+    auto* init = new CProcess((uint8_t*) mem, 4096*getZeroedPage(), initQuota);
+    init->registerProcess();
+    currentProcess = init;
+    mainProcess(init, processArg);
+    joinProcesses();
+    delete init;
+    currentProcess = NULL;
+    stopCompactDaemon();
+    stopDedup();
+    stopTrace();
+    resetSegments();
+    stopZeroPool();
+    stopSwap();
+}
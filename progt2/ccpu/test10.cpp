@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const uint32_t PROCESS_PAGES = 1000;
+
+static void        busyChild                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // keeps accessing its memory while the parent compacts
+  checkResize ( cpu, 200 );
+  for ( int i = 0; i < 20; i ++ )
+    rwTest ( cpu, 0, 200 );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+// the process pages interleaved with one-page segments, the segments are released then, so
+// every other page is free and no large block is; the background compaction makes one soon
+static void        fragment                                ( CCPU            * cpu,
+                                                             bool              background )
+{
+  int segments[PROCESS_PAGES];
+
+  for ( uint32_t i = 0; i < PROCESS_PAGES; i ++ )
+  {
+    checkResize ( cpu, i + 1 );
+    segments[i] = cpu -> CreateSegment ( 1 );
+    if ( segments[i] < 0 )
+      reportError ( "CreateSegment failed\n" );
+  }
+  wTest ( cpu, 0, PROCESS_PAGES );
+  for ( uint32_t i = 0; i < PROCESS_PAGES; i ++ )
+    cpu -> ReleaseSegment ( segments[i] );
+  if ( ! background )
+  {
+    if ( MemMgrFragStats () . m_FreeBlocks[10] )
+      reportError ( "free large block before compaction\n" );
+    return;
+  }
+  // up to 5 s
+  for ( int i = 0; i < 500 && ! MemMgrFragStats () . m_FreeBlocks[10]; i ++ )
+    usleep ( 10000 );
+  if ( ! MemMgrFragStats () . m_FreeBlocks[10] )
+    reportError ( "no free large block made by the background compaction\n" );
+}
+
+static void        largeChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, 1024 );
+  rwTest ( cpu, 0, 1024 );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+static void        compactTest                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // on demand, while another process accesses its memory
+  bool background = ( (const TMemMgrConfig *) arg ) -> m_CompactIntervalMs;
+  pthread_barrier_t bar;
+  pthread_barrier_init ( &bar, NULL, 2 );
+  fragment ( cpu, background );
+  cpu -> NewProcess ( &bar, busyChild, false );
+  if ( MemMgrCompact () < 1 )
+    reportError ( "no free large block after compaction\n" );
+  uint64_t migrated = MemMgrFragStats () . m_MigratedPages;
+  if ( ! migrated )
+    reportError ( "no page migrated\n" );
+  rTest ( cpu, 0, PROCESS_PAGES );
+  iTest ( cpu, PROCESS_PAGES );
+  pthread_barrier_wait ( &bar );
+
+  // SetMemLimit of a large page compacts by itself
+  checkResize ( cpu, 0 );
+  fragment ( cpu, background );
+  cpu -> NewProcess ( &bar, largeChild, false );
+  pthread_barrier_wait ( &bar );
+  pthread_barrier_destroy ( &bar );
+  if ( MemMgrFragStats () . m_MigratedPages == migrated )
+    reportError ( "no page migrated by SetMemLimit\n" );
+  rTest ( cpu, 0, PROCESS_PAGES );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 3000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  TMemMgrConfig config = { false, 0, 0, NULL, true, true, 0 };
+  MemMgrSetConfig ( config );
+  testStart ();
+  MemMgr ( memAligned, PAGES, &config, compactTest );
+  if ( MemMgrFragStats () . m_FreePages != PAGES )
+    reportError ( "pages missing after MemMgr\n" );
+  testEnd ( "test #14" );
+
+  // the same with background compaction
+  config . m_CompactIntervalMs = 1;
+  MemMgrSetConfig ( config );
+  testStart ();
+  MemMgr ( memAligned, PAGES, &config, compactTest );
+  if ( MemMgrFragStats () . m_FreePages != PAGES )
+    reportError ( "pages missing after MemMgr\n" );
+  testEnd ( "test #15" );
+
+  delete [] mem;
+  return 0;
+}
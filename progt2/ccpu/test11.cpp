@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static pthread_barrier_t g_Barrier;
+
+static void        limitedChild                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // the parent's subtree has 302 of 500 pages committed, the child itself 1 (its page directory)
+  checkResize ( cpu, 150 );
+  if ( cpu -> SetMemLimit ( 200 ) )
+    reportError ( "SetMemLimit over the parent's quota succeeds, shall fail\n" );
+  if ( cpu -> SetQuota ( 100 ) )
+    reportError ( "SetQuota below the committed pages succeeds, shall fail\n" );
+  if ( ! cpu -> SetQuota ( 160 ) )
+    reportError ( "SetQuota failed\n" );
+  checkResize ( cpu, 158 );
+  if ( cpu -> SetMemLimit ( 159 ) )
+    reportError ( "SetMemLimit over the own quota succeeds, shall fail\n" );
+  rwiTest ( cpu, 0, 158 );
+  pthread_barrier_wait ( &g_Barrier );
+}
+
+static void        churnChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t seed = (uintptr_t) arg;
+  pthread_barrier_wait ( &g_Barrier );
+  for ( int i = 0; i < 200; i ++ )
+  {
+    seed = seed * 1103515245 + 12345;
+    uint32_t pages = ( seed >> 16 ) % 25;
+    if ( cpu -> SetMemLimit ( pages ) )
+      rwTest ( cpu, pages ? pages - 1 : 0, pages );
+  }
+  cpu -> SetMemLimit ( 0 );
+  pthread_barrier_wait ( &g_Barrier );
+}
+
+static void        quotaTest                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // 100 pages, a page table and the page directory
+  checkResize ( cpu, 100 );
+  if ( cpu -> SetQuota ( 50 ) )
+    reportError ( "SetQuota below the committed pages succeeds, shall fail\n" );
+  if ( ! cpu -> SetQuota ( 500 ) )
+    reportError ( "SetQuota failed\n" );
+  checkResize ( cpu, 498 );
+  if ( cpu -> SetMemLimit ( 499 ) )
+    reportError ( "SetMemLimit over the quota succeeds, shall fail\n" );
+  checkResize ( cpu, 300 );
+  rwTest ( cpu, 0, 300 );
+
+  // the children count against the parent's quota
+  pthread_barrier_init ( &g_Barrier, NULL, 2 );
+  if ( ! cpu -> NewProcess ( NULL, limitedChild, false ) )
+    reportError ( "NewProcess failed\n" );
+  pthread_barrier_wait ( &g_Barrier );
+  pthread_barrier_destroy ( &g_Barrier );
+  if ( cpu -> NewProcess ( NULL, limitedChild, true ) )
+    reportError ( "NewProcess with copyMem over the quota succeeds, shall fail\n" );
+
+  // all the other processes change their limits at once under the quota of the parent
+  checkResize ( cpu, 0 );
+  if ( ! cpu -> SetQuota ( 1200 ) )
+    reportError ( "SetQuota failed\n" );
+  pthread_barrier_init ( &g_Barrier, NULL, PROCESS_MAX );
+  for ( uint32_t i = 1; i < PROCESS_MAX; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) (uintptr_t) i, churnChild, false ) )
+      reportError ( "NewProcess %u failed\n", i );
+  pthread_barrier_wait ( &g_Barrier );
+  pthread_barrier_wait ( &g_Barrier );
+  pthread_barrier_destroy ( &g_Barrier );
+
+  // no quota is lost: the children are gone (or have no pages), 1197 pages, 2 page tables and
+  // the page directory make the 1200 pages
+  for ( int retry = 0; retry < 1000 && ! cpu -> SetMemLimit ( 1197 ); retry ++ )
+    sched_yield ();
+  if ( cpu -> GetMemLimit () != 1197 )
+    reportError ( "SetMemLimit up to the quota failed\n" );
+  if ( cpu -> SetMemLimit ( 1198 ) )
+    reportError ( "SetMemLimit over the quota succeeds, shall fail\n" );
+  rwiTest ( cpu, 0, 1197 );
+  if ( ! cpu -> SetQuota ( 0 ) )
+    reportError ( "SetQuota failed\n" );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 2000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, quotaTest );
+  testEnd ( "test #16" );
+
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const TMemMgrProcessStats * findProcess             ( const TMemMgrStats & stats,
+                                                             const CCPU      * cpu )
+{
+  for ( uint32_t i = 0; i < stats . m_Processes; i ++ )
+    if ( stats . m_Process[i] . m_Cpu == cpu )
+      return &stats . m_Process[i];
+  reportError ( "process missing in the stats\n" );
+  return NULL;
+}
+
+static void        checkTotals                             ( const TMemMgrStats & stats )
+{
+  if ( stats . m_FreePages + stats . m_CachedPages + stats . m_UsedPages != stats . m_TotalPages )
+    reportError ( "free %u + cached %u + used %u != total %u\n", stats . m_FreePages, stats . m_CachedPages,
+                  stats . m_UsedPages, stats . m_TotalPages );
+  if ( stats . m_AllocatedPages - stats . m_FreedPages != stats . m_TotalPages - stats . m_FreePages )
+    reportError ( "allocated %llu - freed %llu != pages taken %u\n", (unsigned long long) stats . m_AllocatedPages,
+                  (unsigned long long) stats . m_FreedPages, stats . m_TotalPages - stats . m_FreePages );
+}
+
+static void        cowChild                                ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // every page written gets a private copy
+  wTest ( cpu, 0, 10 );
+  TMemMgrStats stats = MemMgrStats ();
+  const TMemMgrProcessStats * p = findProcess ( stats, cpu );
+  if ( p && ( p -> m_CowCopies != 10 || p -> m_Faults != 10 || p -> m_Resident != 100 ) )
+    reportError ( "child: %llu cow copies, %llu faults, %u resident, expected 10, 10, 100\n",
+                  (unsigned long long) p -> m_CowCopies, (unsigned long long) p -> m_Faults, p -> m_Resident );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+static void        statsTest                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, 1500 );
+  rwTest ( cpu, 0, 1500 );
+  TMemMgrStats stats = MemMgrStats ();
+  const TMemMgrProcessStats * p = findProcess ( stats, cpu );
+  // 1500 pages, 2 page tables and the page directory, all allocated by SetMemLimit
+  if ( p && ( p -> m_MemLimit != 1500 || p -> m_Resident != 1500 || p -> m_PageTables != 3 || p -> m_Faults ) )
+    reportError ( "limit %u, resident %u, page tables %u, faults %llu, expected 1500, 1500, 3, 0\n",
+                  p -> m_MemLimit, p -> m_Resident, p -> m_PageTables, (unsigned long long) p -> m_Faults );
+  if ( stats . m_UsedPages < 1503 || stats . m_ReservedPages < 1503 )
+    reportError ( "used %u, reserved %u, expected at least 1503\n", stats . m_UsedPages, stats . m_ReservedPages );
+  checkTotals ( stats );
+
+  // the child copies 10 pages on write, the parent takes the same 10 over once the child is gone
+  checkResize ( cpu, 100 );
+  uint32_t reserved = MemMgrStats () . m_ReservedPages;
+  pthread_barrier_t barrier;
+  pthread_barrier_init ( &barrier, NULL, 2 );
+  if ( ! cpu -> NewProcess ( &barrier, cowChild, true ) )
+    reportError ( "NewProcess failed\n" );
+  pthread_barrier_wait ( &barrier );
+  pthread_barrier_destroy ( &barrier );
+  // up to 5 s until the child has given all its pages back (it leaves the process list first)
+  for ( int retry = 0; retry < 500 && MemMgrStats () . m_ReservedPages != reserved; retry ++ )
+    usleep ( 10000 );
+  wTest ( cpu, 0, 10 );
+  stats = MemMgrStats ();
+  p = findProcess ( stats, cpu );
+  if ( stats . m_Processes != 1 )
+    reportError ( "%u processes, expected 1\n", stats . m_Processes );
+  if ( p && ( p -> m_CowReuses != 10 || p -> m_CowCopies ) )
+    reportError ( "parent: %llu cow reuses, %llu copies, expected 10, 0\n",
+                  (unsigned long long) p -> m_CowReuses, (unsigned long long) p -> m_CowCopies );
+  // the child has finished, its counters stay in the totals
+  if ( stats . m_CowCopies != 10 || stats . m_CowReuses != 10 || stats . m_Faults != 20 )
+    reportError ( "totals: %llu cow copies, %llu reuses, %llu faults, expected 10, 10, 20\n",
+                  (unsigned long long) stats . m_CowCopies, (unsigned long long) stats . m_CowReuses,
+                  (unsigned long long) stats . m_Faults );
+  checkTotals ( stats );
+
+  // both dumps are complete
+  char * buf = NULL;
+  size_t len = 0;
+  FILE * fp = open_memstream ( &buf, &len );
+  MemMgrStatsDump ( fp, stats, true );
+  fclose ( fp );
+  if ( len < 3 || buf[0] != '{' || strcmp ( buf + len - 3, "]}\n" ) || ! strstr ( buf, "\"cow_reuses\":10" ) )
+    reportError ( "bad JSON dump: %s", buf );
+  free ( buf );
+  fp = open_memstream ( &buf, &len );
+  MemMgrStatsDump ( fp, stats, false );
+  fclose ( fp );
+  if ( ! strstr ( buf, "faults 20:" ) )
+    reportError ( "bad text dump: %s", buf );
+  free ( buf );
+  checkResize ( cpu, 0 );
+}
+
+static void        lazyTest                                ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, 50 );
+  TMemMgrStats stats = MemMgrStats ();
+  const TMemMgrProcessStats * p = findProcess ( stats, cpu );
+  if ( p && ( p -> m_Resident || p -> m_PageTables != 1 ) )
+    reportError ( "lazy: %u resident, %u page tables before the first access, expected 0, 1\n",
+                  p -> m_Resident, p -> m_PageTables );
+  rwTest ( cpu, 0, 50 );
+  stats = MemMgrStats ();
+  p = findProcess ( stats, cpu );
+  if ( p && ( p -> m_Resident != 50 || p -> m_PageTables != 2 || p -> m_DemandZero != 50 || p -> m_Faults != 50 ) )
+    reportError ( "lazy: %u resident, %u page tables, %llu demand-zero, %llu faults, expected 50, 2, 50, 50\n",
+                  p -> m_Resident, p -> m_PageTables, (unsigned long long) p -> m_DemandZero,
+                  (unsigned long long) p -> m_Faults );
+  checkTotals ( stats );
+  checkResize ( cpu, 0 );
+}
+
+static void        copyAllChild                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  wTest ( cpu, 0, cpu -> GetMemLimit () );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+static void        cowReserveTest                          ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // the shared pages stay reserved for the copies, 2 x 2500 pages do not fit in the memory
+  checkResize ( cpu, 2500 );
+  if ( cpu -> NewProcess ( NULL, copyAllChild, true ) )
+    reportError ( "NewProcess with copyMem over the memory succeeds, shall fail\n" );
+
+  // 2 x 1500 pages do, the child copies all of them
+  checkResize ( cpu, 1500 );
+  rwTest ( cpu, 0, 1500 );
+  uint32_t reserved = MemMgrStats () . m_ReservedPages;
+  pthread_barrier_t barrier;
+  pthread_barrier_init ( &barrier, NULL, 2 );
+  if ( ! cpu -> NewProcess ( &barrier, copyAllChild, true ) )
+    reportError ( "NewProcess failed\n" );
+  pthread_barrier_wait ( &barrier );
+  pthread_barrier_destroy ( &barrier );
+  // up to 5 s until the child has given all its pages back (it leaves the process list first)
+  for ( int retry = 0; retry < 500 && MemMgrStats () . m_ReservedPages != reserved; retry ++ )
+    usleep ( 10000 );
+  TMemMgrStats stats = MemMgrStats ();
+  if ( stats . m_Processes != 1 || stats . m_CowCopies != 1500 || stats . m_ReservedPages != reserved )
+    reportError ( "%u processes, %llu cow copies, %u reserved, expected 1, 1500, %u\n", stats . m_Processes,
+                  (unsigned long long) stats . m_CowCopies, stats . m_ReservedPages, reserved );
+  rTest ( cpu, 0, 1500 );
+  checkTotals ( stats );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 4000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart ();
+  TMemMgrConfig config = TMemMgrConfig ();
+  MemMgrSetConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, statsTest );
+  config . m_LazyAlloc = true;
+  MemMgrSetConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, lazyTest );
+  config . m_LazyAlloc = false;
+  config . m_CowReserve = true;
+  MemMgrSetConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, cowReserveTest );
+  MemMgrSetConfig ( TMemMgrConfig () );
+  TMemMgrStats stats = MemMgrStats ();
+  if ( stats . m_Processes || stats . m_FreePages != PAGES )
+    reportError ( "after MemMgr: %u processes, %u free pages\n", stats . m_Processes, stats . m_FreePages );
+  testEnd ( "test #17" );
+
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const uint32_t PAGES = 300;
+
+static void        traceChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t val;
+  for ( uint32_t i = 0; i < PAGES; i ++ )
+    cpu -> ReadInt ( i * CCPU::PAGE_SIZE, val );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+static void        traceTest                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // lazy allocation: the first write of each page faults, the read after it does not
+  checkResize ( cpu, PAGES );
+  for ( uint32_t i = 0; i < PAGES; i ++ )
+    cpu -> WriteInt ( i * CCPU::PAGE_SIZE + 8, i );
+  uint32_t val;
+  for ( uint32_t i = 0; i < PAGES; i ++ )
+    cpu -> ReadInt ( i * CCPU::PAGE_SIZE + 8, val );
+  // more records than fit in a ring
+  for ( uint32_t r = 0; r < 300; r ++ )
+    for ( uint32_t i = 0; i < PAGES; i ++ )
+      cpu -> ReadInt ( i * CCPU::PAGE_SIZE, val );
+  pthread_barrier_t barrier;
+  pthread_barrier_init ( &barrier, NULL, 2 );
+  if ( ! cpu -> NewProcess ( &barrier, traceChild, true ) )
+    reportError ( "NewProcess failed\n" );
+  pthread_barrier_wait ( &barrier );
+  pthread_barrier_destroy ( &barrier );
+}
+
+int                main                                    ( void )
+{
+  const int MEM_PAGES = 1000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ MEM_PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  char path[] = "/tmp/ccpu_traceXXXXXX";
+  int fd = mkstemp ( path );
+  close ( fd );
+  testStart ();
+  TMemMgrConfig config = TMemMgrConfig ();
+  config . m_LazyAlloc = true;
+  config . m_TraceFile = path;
+  MemMgrSetConfig ( config );
+  MemMgr ( memAligned, MEM_PAGES, NULL, traceTest );
+  MemMgrSetConfig ( TMemMgrConfig () );
+
+  FILE * fp = fopen ( path, "rb" );
+  char magic[sizeof ( TRACE_MAGIC )];
+  if ( ! fp || fread ( magic, sizeof ( magic ), 1, fp ) != 1 || memcmp ( magic, TRACE_MAGIC, sizeof ( magic ) ) )
+    reportError ( "trace file missing or without the header\n" );
+  uint32_t n[2] = { 0, 0 }, faults = 0, writes = 0, misordered = 0;
+  uint64_t last[2] = { 0, 0 };
+  TTraceRecord rec;
+  while ( fp && fread ( &rec, sizeof ( rec ), 1, fp ) == 1 )
+  {
+    if ( rec . m_Process > 1 )
+    {
+      reportError ( "record of process %u\n", rec . m_Process );
+      continue;
+    }
+    uint32_t i = n[rec . m_Process] ++;
+    // the parent writes, reads and then reads again 300 times, the child reads once
+    uint32_t expected = rec . m_Process ? i : i % PAGES;
+    if ( rec . m_Page != expected || rec . m_Time < last[rec . m_Process] )
+      misordered ++;
+    last[rec . m_Process] = rec . m_Time;
+    faults += ( rec . m_Flags & TRACE_FAULT ) != 0;
+    writes += ( rec . m_Flags & TRACE_WRITE ) != 0;
+  }
+  if ( fp )
+    fclose ( fp );
+  if ( n[0] != 302 * PAGES || n[1] != PAGES )
+    reportError ( "%u and %u records, expected %u and %u\n", n[0], n[1], 302 * PAGES, PAGES );
+  if ( misordered )
+    reportError ( "%u records out of order\n", misordered );
+  if ( writes != PAGES || faults != PAGES )
+    reportError ( "%u writes, %u faults, expected %u, %u\n", writes, faults, PAGES, PAGES );
+  unlink ( path );
+  testEnd ( "test #18" );
+
+  delete [] mem;
+  return 0;
+}
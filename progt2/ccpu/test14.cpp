@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <initializer_list>
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const uint32_t PAGES = 2000;
+
+static TMemMgrProcessStats processStats                    ( CCPU            * cpu )
+{
+  TMemMgrStats stats = MemMgrStats ();
+  for ( uint32_t i = 0; i < stats . m_Processes; i ++ )
+    if ( stats . m_Process[i] . m_Cpu == cpu )
+      return stats . m_Process[i];
+  reportError ( "process missing in the stats\n" );
+  return TMemMgrProcessStats ();
+}
+
+static void        faultAroundTest                         ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // a sequential stream: the window grows, most pages are populated ahead of the faults
+  checkResize ( cpu, PAGES );
+  rwiTest ( cpu, 0, PAGES );
+  TMemMgrProcessStats s = processStats ( cpu );
+  if ( s . m_DemandZero + s . m_Prefaulted != PAGES || s . m_Faults > PAGES / 20 )
+    reportError ( "sequential: %llu faults, %llu demand-zero, %llu prefaulted, expected %u pages in under %u faults\n",
+                  (unsigned long long) s . m_Faults, (unsigned long long) s . m_DemandZero,
+                  (unsigned long long) s . m_Prefaulted, PAGES, PAGES / 20 );
+  if ( s . m_PrefaultHits > s . m_Prefaulted || s . m_PrefaultHits < s . m_Prefaulted / 2 )
+    reportError ( "sequential: %llu of %llu prefaulted pages used\n", (unsigned long long) s . m_PrefaultHits,
+                  (unsigned long long) s . m_Prefaulted );
+  rTest ( cpu, 0, PAGES );
+  checkResize ( cpu, 0 );
+
+  // every other page: no stream, nothing populated ahead, the pages in between stay absent
+  checkResize ( cpu, PAGES );
+  TMemMgrProcessStats before = processStats ( cpu );
+  for ( uint32_t i = 0; i < PAGES; i += 2 )
+    if ( ! cpu -> WriteInt ( i * CCPU::PAGE_SIZE, i ) )
+      reportError ( "WriteInt failed\n" );
+  s = processStats ( cpu );
+  if ( s . m_Prefaulted != before . m_Prefaulted || s . m_DemandZero - before . m_DemandZero != PAGES / 2
+       || s . m_Resident != PAGES / 2 )
+    reportError ( "stride: %llu prefaulted, %llu demand-zero, %u resident, expected 0, %u, %u\n",
+                  (unsigned long long) ( s . m_Prefaulted - before . m_Prefaulted ),
+                  (unsigned long long) ( s . m_DemandZero - before . m_DemandZero ), s . m_Resident, PAGES / 2, PAGES / 2 );
+  rwTest ( cpu, 0, PAGES );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  const int MEM_PAGES = 4000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ MEM_PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart ();
+  for ( uint32_t pool : { 0, 256 } )
+  {
+    TMemMgrConfig config = TMemMgrConfig ();
+    config . m_LazyAlloc = true;
+    config . m_ZeroPoolPages = pool;
+    config . m_FaultAround = 64;
+    MemMgrSetConfig ( config );
+    MemMgr ( memAligned, MEM_PAGES, NULL, faultAroundTest );
+  }
+  MemMgrSetConfig ( TMemMgrConfig () );
+  testEnd ( "test #19" );
+
+  delete [] mem;
+  return 0;
+}
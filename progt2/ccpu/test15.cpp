@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const uint32_t PAGES = 200;
+
+struct TDedupArg
+{
+  pthread_barrier_t          m_Written;
+  pthread_barrier_t          m_Merged;
+  pthread_barrier_t          m_Done;
+};
+
+// page i < PAGES / 2 holds i + 1 in its first word, the pages above are zero
+static void        checkPages                              ( CCPU            * cpu,
+                                                             const char      * who )
+{
+  for ( uint32_t i = 0; i < PAGES; i ++ )
+  {
+    uint32_t val;
+    if ( ! cpu -> ReadInt ( i * CCPU::PAGE_SIZE, val ) || val != ( i < PAGES / 2 ? i + 1 : 0 ) )
+      reportError ( "%s: page %u holds %u\n", who, i, val );
+  }
+}
+
+static void        dedupChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TDedupArg * a = (TDedupArg *) arg;
+  // private copies of the parent's pages with the same contents
+  for ( uint32_t i = 0; i < PAGES / 2; i ++ )
+    if ( ! cpu -> WriteInt ( i * CCPU::PAGE_SIZE, i + 1 ) )
+      reportError ( "child: WriteInt failed\n" );
+  pthread_barrier_wait ( &a -> m_Written );
+  pthread_barrier_wait ( &a -> m_Merged );
+  checkPages ( cpu, "child" );
+  // the parent's writes after the merge are not seen here
+  pthread_barrier_wait ( &a -> m_Done );
+  checkPages ( cpu, "child" );
+}
+
+static void        dedupTest                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, PAGES );
+  // the pages hold whatever the memory held before
+  if ( ! cpu -> Fill ( 0, 0, PAGES * CCPU::PAGE_SIZE ) )
+    reportError ( "Fill failed\n" );
+  for ( uint32_t i = 0; i < PAGES / 2; i ++ )
+    if ( ! cpu -> WriteInt ( i * CCPU::PAGE_SIZE, i + 1 ) )
+      reportError ( "WriteInt failed\n" );
+
+  // the zero pages end up in one frame, the pages merged stay reserved
+  TMemMgrStats before = MemMgrStats ();
+  uint32_t merged = MemMgrDedup ();
+  TMemMgrStats stats = MemMgrStats ();
+  if ( merged != PAGES / 2 - 1 || stats . m_DedupMerged != merged || stats . m_FreePages - before . m_FreePages != merged
+       || stats . m_ReservedPages != before . m_ReservedPages )
+    reportError ( "zero pages: %u merged, %llu in the stats, %u pages freed, %u reserved, expected %u, %u\n", merged,
+                  (unsigned long long) stats . m_DedupMerged, stats . m_FreePages - before . m_FreePages,
+                  stats . m_ReservedPages, PAGES / 2 - 1, before . m_ReservedPages );
+  checkPages ( cpu, "parent" );
+
+  // a write gets a private copy again, even with all the memory reserved
+  uint32_t limit = PAGES;
+  while ( cpu -> SetMemLimit ( limit + 1 ) )
+    limit ++;
+  uint32_t val;
+  if ( ! cpu -> WriteInt ( ( PAGES - 1 ) * CCPU::PAGE_SIZE + 4, 7 ) || ! cpu -> ReadInt ( ( PAGES - 1 ) * CCPU::PAGE_SIZE + 4, val )
+       || val != 7 || ! cpu -> ReadInt ( ( PAGES - 2 ) * CCPU::PAGE_SIZE + 4, val ) || val )
+    reportError ( "write to a merged page\n" );
+  if ( ! cpu -> WriteInt ( ( PAGES - 1 ) * CCPU::PAGE_SIZE + 4, 0 ) )
+    reportError ( "WriteInt failed\n" );
+  checkResize ( cpu, PAGES );
+
+  // the copies the child makes are merged with the pages of the parent
+  TDedupArg a;
+  pthread_barrier_init ( &a . m_Written, NULL, 2 );
+  pthread_barrier_init ( &a . m_Merged, NULL, 2 );
+  pthread_barrier_init ( &a . m_Done, NULL, 2 );
+  if ( ! cpu -> NewProcess ( &a, dedupChild, true ) )
+    reportError ( "NewProcess failed\n" );
+  pthread_barrier_wait ( &a . m_Written );
+  before = MemMgrStats ();
+  merged = MemMgrDedup ();
+  stats = MemMgrStats ();
+  // the last page written by the parent is identical to the other zero pages again
+  if ( merged != PAGES / 2 + 1 || stats . m_FreePages - before . m_FreePages != merged
+       || stats . m_ReservedPages != before . m_ReservedPages )
+    reportError ( "child: %u merged, %u pages freed, %u reserved, expected %u, %u\n", merged,
+                  stats . m_FreePages - before . m_FreePages, stats . m_ReservedPages, PAGES / 2 + 1,
+                  before . m_ReservedPages );
+  pthread_barrier_wait ( &a . m_Merged );
+  checkPages ( cpu, "parent" );
+  for ( uint32_t i = 0; i < PAGES; i ++ )
+    if ( ! cpu -> WriteInt ( i * CCPU::PAGE_SIZE + 8, i ) )
+      reportError ( "WriteInt failed\n" );
+  pthread_barrier_wait ( &a . m_Done );
+  for ( uint32_t i = 0; i < PAGES; i ++ )
+    if ( ! cpu -> ReadInt ( i * CCPU::PAGE_SIZE + 8, val ) || val != i )
+      reportError ( "parent: page %u holds %u\n", i, val );
+  pthread_barrier_destroy ( &a . m_Written );
+  pthread_barrier_destroy ( &a . m_Merged );
+  pthread_barrier_destroy ( &a . m_Done );
+}
+
+static void        backgroundTest                          ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, PAGES );
+  if ( ! cpu -> Fill ( 0, 0, PAGES * CCPU::PAGE_SIZE ) )
+    reportError ( "Fill failed\n" );
+  // up to 5 s for the background merging of the zero pages
+  TMemMgrStats stats;
+  for ( int i = 0; i < 500; i ++ )
+  {
+    stats = MemMgrStats ();
+    if ( stats . m_DedupMerged >= PAGES - 1 )
+      break;
+    usleep ( 10000 );
+  }
+  if ( stats . m_DedupMerged < PAGES - 1 || ! stats . m_DedupScanned )
+    reportError ( "background: %llu merged, %llu scanned, expected %u merged at least\n",
+                  (unsigned long long) stats . m_DedupMerged, (unsigned long long) stats . m_DedupScanned, PAGES - 1 );
+  rwiTest ( cpu, 0, PAGES );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  const int MEM_PAGES = 1000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ MEM_PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart ();
+  TMemMgrConfig config = TMemMgrConfig ();
+  config . m_Dedup = true;
+  MemMgrSetConfig ( config );
+  MemMgr ( memAligned, MEM_PAGES, NULL, dedupTest );
+  config . m_DedupScanRate = 100000;
+  MemMgrSetConfig ( config );
+  MemMgr ( memAligned, MEM_PAGES, NULL, backgroundTest );
+  MemMgrSetConfig ( TMemMgrConfig () );
+  testEnd ( "test #20" );
+
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const uint32_t BLOCK_PAGES = 40;
+static uint8_t     g_Ref[BLOCK_PAGES * CCPU::PAGE_SIZE];
+
+static void        checkBlock                              ( CCPU            * cpu,
+                                                             const char      * what )
+{
+  static uint8_t buf[BLOCK_PAGES * CCPU::PAGE_SIZE];
+
+  if ( ! cpu -> ReadBlock ( 0, buf, sizeof ( buf ) ) )
+    reportError ( "%s: ReadBlock failed\n", what );
+  else if ( memcmp ( buf, g_Ref, sizeof ( buf ) ) )
+    reportError ( "%s: block mismatch\n", what );
+}
+
+static void        blockChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // the copy-on-write child changes its copy only
+  cpu -> Fill ( 0, 0xab, 3 * CCPU::PAGE_SIZE );
+  memset ( g_Ref, 0xab, 3 * CCPU::PAGE_SIZE );
+  checkBlock ( cpu, "child" );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+static void        blockTest                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint8_t data[3 * CCPU::PAGE_SIZE + 100];
+  uint32_t val;
+
+  checkResize ( cpu, BLOCK_PAGES );
+  for ( uint32_t i = 0; i < sizeof ( g_Ref ); i ++ )
+    g_Ref[i] = i * 7 + ( i >> 12 );
+  if ( ! cpu -> WriteBlock ( 0, g_Ref, sizeof ( g_Ref ) ) )
+    reportError ( "WriteBlock failed\n" );
+  checkBlock ( cpu, "write" );
+  if ( ! cpu -> ReadInt ( 5 * CCPU::PAGE_SIZE + 16, val ) || memcmp ( &val, g_Ref + 5 * CCPU::PAGE_SIZE + 16, 4 ) )
+    reportError ( "ReadInt after WriteBlock mismatch\n" );
+
+  // unaligned, across page boundaries
+  for ( uint32_t i = 0; i < sizeof ( data ); i ++ )
+    data[i] = i ^ 0x5a;
+  cpu -> WriteBlock ( 2 * CCPU::PAGE_SIZE - 37, data, sizeof ( data ) );
+  memcpy ( g_Ref + 2 * CCPU::PAGE_SIZE - 37, data, sizeof ( data ) );
+  checkBlock ( cpu, "unaligned write" );
+
+  cpu -> Fill ( 7 * CCPU::PAGE_SIZE + 3, 0x11, 2 * CCPU::PAGE_SIZE + 5 );
+  memset ( g_Ref + 7 * CCPU::PAGE_SIZE + 3, 0x11, 2 * CCPU::PAGE_SIZE + 5 );
+  checkBlock ( cpu, "fill" );
+
+  // overlapping copies in both directions
+  cpu -> CopyBlock ( 10 * CCPU::PAGE_SIZE + 100, 10 * CCPU::PAGE_SIZE, 5 * CCPU::PAGE_SIZE );
+  memmove ( g_Ref + 10 * CCPU::PAGE_SIZE + 100, g_Ref + 10 * CCPU::PAGE_SIZE, 5 * CCPU::PAGE_SIZE );
+  checkBlock ( cpu, "copy up" );
+  cpu -> CopyBlock ( 20 * CCPU::PAGE_SIZE, 20 * CCPU::PAGE_SIZE + 2000, 6 * CCPU::PAGE_SIZE );
+  memmove ( g_Ref + 20 * CCPU::PAGE_SIZE, g_Ref + 20 * CCPU::PAGE_SIZE + 2000, 6 * CCPU::PAGE_SIZE );
+  checkBlock ( cpu, "copy down" );
+  cpu -> CopyBlock ( 30 * CCPU::PAGE_SIZE + 5, CCPU::PAGE_SIZE + 9, 4 * CCPU::PAGE_SIZE );
+  memmove ( g_Ref + 30 * CCPU::PAGE_SIZE + 5, g_Ref + CCPU::PAGE_SIZE + 9, 4 * CCPU::PAGE_SIZE );
+  checkBlock ( cpu, "copy" );
+
+  // ranges reaching past the limit fail
+  if ( cpu -> ReadBlock ( ( BLOCK_PAGES - 1 ) * CCPU::PAGE_SIZE, data, sizeof ( data ) ) )
+    reportError ( "ReadBlock past the limit succeeds, shall fail\n" );
+  if ( cpu -> Fill ( ( BLOCK_PAGES - 1 ) * CCPU::PAGE_SIZE + 1, 0, 2 * CCPU::PAGE_SIZE ) )
+    reportError ( "Fill past the limit succeeds, shall fail\n" );
+  memset ( g_Ref + ( BLOCK_PAGES - 1 ) * CCPU::PAGE_SIZE + 1, 0, CCPU::PAGE_SIZE - 1 );
+  if ( cpu -> CopyBlock ( 0, BLOCK_PAGES * CCPU::PAGE_SIZE, 1 ) )
+    reportError ( "CopyBlock from past the limit succeeds, shall fail\n" );
+  checkBlock ( cpu, "partial fill" );
+
+  static uint8_t parent[BLOCK_PAGES * CCPU::PAGE_SIZE];
+  memcpy ( parent, g_Ref, sizeof ( parent ) );
+  pthread_barrier_t bar;
+  pthread_barrier_init ( &bar, NULL, 2 );
+  cpu -> NewProcess ( &bar, blockChild, true );
+  pthread_barrier_wait ( &bar );
+  memcpy ( g_Ref, parent, sizeof ( parent ) );
+  checkBlock ( cpu, "parent" );
+  pthread_barrier_destroy ( &bar );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 1024;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, blockTest );
+  testEnd ( "test #7" );
+
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const uint32_t PROCESS_PAGES = 1000;
+
+static void        swapChild                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // shares the (mostly swapped out) memory of the parent, then overwrites the upper half
+  rTest ( cpu, 0, PROCESS_PAGES / 2 );
+  wTest ( cpu, PROCESS_PAGES / 2 + 1, PROCESS_PAGES );
+  rTest ( cpu, PROCESS_PAGES / 2 + 1, PROCESS_PAGES );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+static void        swapWorker                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t pages = (uintptr_t) arg;
+  checkResize ( cpu, pages );
+  for ( int i = 0; i < 3; i ++ )
+    rwTest ( cpu, 0, pages );
+}
+
+static void        swapTest                                ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // four times the physical memory
+  checkResize ( cpu, PROCESS_PAGES );
+  rwiTest ( cpu, 0, PROCESS_PAGES );
+  rTest ( cpu, 0, PROCESS_PAGES );
+
+  pthread_barrier_t bar;
+  pthread_barrier_init ( &bar, NULL, 2 );
+  if ( ! cpu -> NewProcess ( &bar, swapChild, true ) )
+    reportError ( "NewProcess failed\n" );
+  pthread_barrier_wait ( &bar );
+  pthread_barrier_destroy ( &bar );
+  rTest ( cpu, 0, PROCESS_PAGES );
+
+  // concurrent processes evicting each other's pages
+  for ( uintptr_t i = 0; i < 4; i ++ )
+    cpu -> NewProcess ( (void *) ( 200 + 50 * i ), swapWorker, false );
+  rTest ( cpu, 0, PROCESS_PAGES );
+}
+
+static void        quotaTest                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // physical memory plus swap is the limit, minus the page directories
+  checkResize ( cpu, 2000 );
+  if ( cpu -> SetMemLimit ( 2500 ) )
+    reportError ( "SetMemLimit beyond physical memory + swap succeeds, shall fail\n" );
+  rwTest ( cpu, 1900, 2000 );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 256;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  TMemMgrConfig config = { false, 0, 2048, NULL };
+  MemMgrSetConfig ( config );
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, swapTest );
+  if ( ! MemMgrSwapStats () . m_SwapIns || ! MemMgrSwapStats () . m_SwapOuts )
+    reportError ( "no swapping recorded\n" );
+  testEnd ( "test #8" );
+
+  config . m_LazyAlloc = true;
+  config . m_ZeroPoolPages = 32;
+  MemMgrSetConfig ( config );
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, swapTest );
+  testEnd ( "test #9" );
+
+  config = { false, 0, 2048, NULL };
+  MemMgrSetConfig ( config );
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, quotaTest );
+  // more swap than a page table entry can address, clamped
+  config . m_SwapPages = UINT32_MAX;
+  MemMgrSetConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, swapTest );
+  testEnd ( "test #10" );
+
+  delete [] mem;
+  return 0;
+}
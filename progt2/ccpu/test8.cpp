@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static const uint32_t SEG_PAGES   = 300;
+static const uint32_t SEG_PARENT  = 0x40000000;
+static const uint32_t SEG_CHILD   = 0x00800000;
+
+struct TShared
+{
+  int                        m_Id;
+  pthread_barrier_t          m_Barrier;
+};
+
+static void        consumer                                ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TShared * shared = (TShared *) arg;
+  uint32_t val;
+
+  checkResize ( cpu, 100 );
+  if ( ! cpu -> MapSegment ( shared -> m_Id, SEG_CHILD ) )
+    reportError ( "MapSegment in the child failed\n" );
+  pthread_barrier_wait ( &shared -> m_Barrier );
+
+  // the producer has filled the segment
+  for ( uint32_t i = 0; i < SEG_PAGES; i ++ )
+    if ( ! cpu -> ReadInt ( SEG_CHILD + i * CCPU::PAGE_SIZE + 8, val ) || val != i * 3 )
+      reportError ( "segment mismatch in the child, page %u\n", i );
+  cpu -> CopyBlock ( SEG_CHILD + CCPU::PAGE_SIZE, SEG_CHILD, 4 );
+  rwTest ( cpu, 0, 100 );
+  pthread_barrier_wait ( &shared -> m_Barrier );
+  // the mapping goes away with the process
+}
+
+static void        segmentTest                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  static TShared shared;
+  uint32_t val;
+
+  checkResize ( cpu, 1500 );
+  shared . m_Id = cpu -> CreateSegment ( SEG_PAGES );
+  if ( shared . m_Id < 0 )
+    reportError ( "CreateSegment failed\n" );
+
+  // the memory limit and the segment cannot share page tables
+  if ( cpu -> MapSegment ( shared . m_Id, 0x00100000 ) )
+    reportError ( "MapSegment below the limit succeeds, shall fail\n" );
+  if ( cpu -> MapSegment ( shared . m_Id, SEG_PARENT + 16 ) )
+    reportError ( "MapSegment unaligned succeeds, shall fail\n" );
+  if ( cpu -> MapSegment ( shared . m_Id + 1, SEG_PARENT ) )
+    reportError ( "MapSegment of an unknown segment succeeds, shall fail\n" );
+  if ( ! cpu -> MapSegment ( shared . m_Id, SEG_PARENT ) )
+    reportError ( "MapSegment failed\n" );
+  if ( cpu -> MapSegment ( shared . m_Id, SEG_PARENT + CCPU::PAGE_SIZE ) )
+    reportError ( "MapSegment over another mapping succeeds, shall fail\n" );
+  if ( ! cpu -> ReadInt ( SEG_PARENT, val ) || val )
+    reportError ( "new segment not zeroed\n" );
+
+  pthread_barrier_init ( &shared . m_Barrier, NULL, 2 );
+  cpu -> NewProcess ( &shared, consumer, false );
+  for ( uint32_t i = 0; i < SEG_PAGES; i ++ )
+    cpu -> WriteInt ( SEG_PARENT + i * CCPU::PAGE_SIZE + 8, i * 3 );
+  pthread_barrier_wait ( &shared . m_Barrier );
+  pthread_barrier_wait ( &shared . m_Barrier );
+  if ( ! cpu -> ReadInt ( SEG_PARENT + CCPU::PAGE_SIZE, val ) || val != 0 )
+    reportError ( "the child's write not seen\n" );
+  pthread_barrier_destroy ( &shared . m_Barrier );
+
+  // the limit cannot grow into the segment
+  if ( cpu -> SetMemLimit ( SEG_PARENT / CCPU::PAGE_SIZE + 1 ) )
+    reportError ( "SetMemLimit over a segment succeeds, shall fail\n" );
+  rwTest ( cpu, 0, 1500 );
+
+  if ( ! cpu -> UnmapSegment ( SEG_PARENT ) )
+    reportError ( "UnmapSegment failed\n" );
+  if ( cpu -> ReadInt ( SEG_PARENT, val ) )
+    reportError ( "read of an unmapped segment succeeds, shall fail\n" );
+  iTest ( cpu, 1500 );
+  if ( ! cpu -> ReleaseSegment ( shared . m_Id ) || cpu -> ReleaseSegment ( shared . m_Id ) )
+    reportError ( "ReleaseSegment\n" );
+  if ( cpu -> MapSegment ( shared . m_Id, SEG_PARENT ) )
+    reportError ( "MapSegment of a released segment succeeds, shall fail\n" );
+
+  // all the segment pages are back
+  checkResize ( cpu, 2000 - 10 );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 2000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, segmentTest );
+  testEnd ( "test #11" );
+
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+static void        largeChild                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // the parent's large pages are split and shared copy-on-write
+  uint32_t val;
+  rTest ( cpu, 0, 2500 );
+  for ( uint32_t i = 0; i < 2500; i += 7 )
+    cpu -> WriteInt ( i * CCPU::PAGE_SIZE + 12, 0xc0de0000 + i );
+  for ( uint32_t i = 0; i < 2500; i += 7 )
+    if ( ! cpu -> ReadInt ( i * CCPU::PAGE_SIZE + 12, val ) || val != 0xc0de0000 + i )
+      reportError ( "child's write lost, page %u\n", i );
+  pthread_barrier_wait ( (pthread_barrier_t *) arg );
+}
+
+static void        largeTest                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // two whole 4 MiB regions and a part of the third one
+  checkResize ( cpu, 2500 );
+  rwiTest ( cpu, 0, 2500 );
+  // a block crossing the boundary of two large pages
+  uint32_t buf[1024], out[1024];
+  for ( uint32_t i = 0; i < 1024; i ++ )
+    buf[i] = i * 13;
+  cpu -> WriteBlock ( CCPU::LARGE_PAGE_SIZE - 2048, buf, sizeof ( buf ) );
+  cpu -> ReadBlock ( CCPU::LARGE_PAGE_SIZE - 2048, out, sizeof ( out ) );
+  if ( memcmp ( buf, out, sizeof ( buf ) ) )
+    reportError ( "block across large pages mismatch\n" );
+  wTest ( cpu, 0, 2500 );
+
+  pthread_barrier_t bar;
+  pthread_barrier_init ( &bar, NULL, 2 );
+  if ( ! cpu -> NewProcess ( &bar, largeChild, true ) )
+    reportError ( "NewProcess failed\n" );
+  pthread_barrier_wait ( &bar );
+  pthread_barrier_destroy ( &bar );
+  rTest ( cpu, 0, 2500 );
+
+  // shrinking into a large page splits it, whole ones are freed at once
+  checkResize ( cpu, 1500 );
+  rTest ( cpu, 0, 1500 );
+  iTest ( cpu, 1500 );
+  checkResize ( cpu, 0 );
+  checkResize ( cpu, 3072 );
+  rwTest ( cpu, 0, 3072 );
+  checkResize ( cpu, 1024 );
+  rwiTest ( cpu, 0, 1024 );
+  checkResize ( cpu, 4000 - 10 );
+  checkResize ( cpu, 0 );
+  // the freed pages coalesce back to large blocks
+  if ( MemMgrFragStats () . m_LargestBlock != CCPU::PAGE_DIR_ENTRIES )
+    reportError ( "no free large block after shrinking to zero\n" );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 4000;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  TMemMgrConfig config = { false, 0, 0, NULL, true };
+  MemMgrSetConfig ( config );
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, largeTest );
+  if ( MemMgrFragStats () . m_FreePages != PAGES )
+    reportError ( "pages missing after MemMgr\n" );
+  testEnd ( "test #12" );
+
+  config . m_ZeroPoolPages = 64;
+  MemMgrSetConfig ( config );
+  testStart ();
+  MemMgr ( memAligned, PAGES, NULL, largeTest );
+  if ( MemMgrFragStats () . m_FreePages != PAGES )
+    reportError ( "pages missing after MemMgr\n" );
+  testEnd ( "test #13" );
+
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,191 @@
+// Offline analysis of an access trace written by MemMgr (TMemMgrConfig::m_TraceFile). For each
+// process: the LRU reuse distance of the pages (how many other pages were touched since the last
+// access to the same page), the working-set size over time (distinct pages per window) and the
+// runs of strictly sequential page accesses. Built by "make trace_analyze".
+// Usage: ./trace_analyze trace-file [window-ms]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <pthread.h>
+#include "common.h"
+using namespace std;
+
+// log2 buckets: 0, 1, 2-3, 4-7, ...
+static const int   BUCKETS = 33;
+
+static int         bucket                                  ( uint64_t          value )
+{
+  int res = 0;
+  while ( value )
+  {
+    value >>= 1;
+    res ++;
+  }
+  return res;
+}
+
+static void        printHistogram                          ( const char      * name,
+                                                             const uint64_t  * hist,
+                                                             uint64_t          total )
+{
+  printf ( "  %s:\n", name );
+  for ( int i = 0; i < BUCKETS; i ++ )
+    if ( hist[i] )
+    {
+      uint64_t lo = i ? 1ull << ( i - 1 ) : 0, hi = i ? ( 1ull << i ) - 1 : 0;
+      printf ( "    %10llu - %-10llu %12llu %6.2f %%\n", (unsigned long long) lo, (unsigned long long) hi,
+               (unsigned long long) hist[i], 100.0 * hist[i] / total );
+    }
+}
+
+// Fenwick tree over the positions in the trace, a position holds 1 while it is the last access of its page.
+class CFenwick
+{
+  public:
+                             CFenwick                      ( size_t            n )
+                             : m_Tree ( n + 1, 0 )
+    {
+    }
+    void                     add                           ( size_t            pos,
+                                                             int               delta )
+    {
+      for ( pos ++; pos < m_Tree . size (); pos += pos & -pos )
+        m_Tree[pos] += delta;
+    }
+    // sum over [0, pos)
+    int64_t                  prefix                        ( size_t            pos ) const
+    {
+      int64_t res = 0;
+      for ( ; pos; pos -= pos & -pos )
+        res += m_Tree[pos];
+      return res;
+    }
+  private:
+    vector<int64_t>          m_Tree;
+};
+
+static void        analyzeProcess                          ( uint16_t          process,
+                                                             const vector<TTraceRecord> & trace,
+                                                             uint64_t          windowNs )
+{
+  uint64_t writes = 0, faults = 0;
+  for ( const auto & r : trace )
+  {
+    writes += ( r . m_Flags & TRACE_WRITE ) != 0;
+    faults += ( r . m_Flags & TRACE_FAULT ) != 0;
+  }
+  double span = ( trace . back () . m_Time - trace . front () . m_Time ) / 1e9;
+  printf ( "process %u: %zu accesses, %llu writes, %llu faults, %.3f s\n", process, trace . size (),
+           (unsigned long long) writes, (unsigned long long) faults, span );
+
+  // reuse distance = distinct pages accessed since the previous access to the same page
+  uint64_t reuse[BUCKETS] = {}, cold = 0;
+  CFenwick last ( trace . size () );
+  unordered_map<uint32_t, size_t> lastPos;
+  for ( size_t i = 0; i < trace . size (); i ++ )
+  {
+    auto it = lastPos . find ( trace[i] . m_Page );
+    if ( it == lastPos . end () )
+    {
+      cold ++;
+      lastPos[trace[i] . m_Page] = i;
+    }
+    else
+    {
+      reuse[bucket ( last . prefix ( i ) - last . prefix ( it -> second + 1 ) )] ++;
+      last . add ( it -> second, -1 );
+      it -> second = i;
+    }
+    last . add ( i, 1 );
+  }
+  printf ( "  distinct pages: %zu (first accesses)\n", lastPos . size () );
+  if ( trace . size () > cold )
+    printHistogram ( "reuse distance", reuse, trace . size () - cold );
+
+  // working set per window
+  printf ( "  working set, %.3f ms windows:\n", windowNs / 1e6 );
+  unordered_set<uint32_t> window;
+  uint64_t start = trace . front () . m_Time, peak = 0, sum = 0, windows = 0;
+  for ( size_t i = 0; i <= trace . size (); i ++ )
+  {
+    if ( i == trace . size () || trace[i] . m_Time >= start + windowNs )
+    {
+      printf ( "    %10.3f ms %8zu pages\n", ( start - trace . front () . m_Time ) / 1e6, window . size () );
+      peak = window . size () > peak ? window . size () : peak;
+      sum += window . size ();
+      windows ++;
+      window . clear ();
+      if ( i == trace . size () )
+        break;
+      start += ( trace[i] . m_Time - start ) / windowNs * windowNs;
+    }
+    window . insert ( trace[i] . m_Page );
+  }
+  printf ( "    average %.1f, peak %llu pages\n", (double) sum / windows, (unsigned long long) peak );
+
+  // sequential runs, repeated accesses to the same page do not break a run
+  uint64_t runs[BUCKETS] = {}, nRuns = 0, longest = 0, changes = 0, sequential = 0;
+  uint64_t run = 1;
+  for ( size_t i = 1; i <= trace . size (); i ++ )
+  {
+    if ( i < trace . size () && trace[i] . m_Page == trace[i - 1] . m_Page )
+      continue;
+    if ( i < trace . size () && trace[i] . m_Page == trace[i - 1] . m_Page + 1 )
+    {
+      changes ++;
+      sequential ++;
+      run ++;
+      continue;
+    }
+    changes += i < trace . size ();
+    runs[bucket ( run )] ++;
+    nRuns ++;
+    longest = run > longest ? run : longest;
+    run = 1;
+  }
+  printf ( "  sequential: %.2f %% of page changes go to the next page, %llu runs, longest %llu pages\n",
+           changes ? 100.0 * sequential / changes : 0.0, (unsigned long long) nRuns, (unsigned long long) longest );
+  printHistogram ( "run length (pages)", runs, nRuns );
+}
+
+int                main                                    ( int               argc,
+                                                             char            * argv [] )
+{
+  if ( argc < 2 )
+  {
+    fprintf ( stderr, "usage: %s trace-file [window-ms]\n", argv[0] );
+    return 1;
+  }
+  uint64_t windowNs = ( argc > 2 ? atof ( argv[2] ) : 10 ) * 1e6;
+  if ( ! windowNs )
+    windowNs = 1;
+  FILE * fp = fopen ( argv[1], "rb" );
+  if ( ! fp )
+  {
+    perror ( argv[1] );
+    return 1;
+  }
+  char magic[sizeof ( TRACE_MAGIC )];
+  if ( fread ( magic, sizeof ( magic ), 1, fp ) != 1 || memcmp ( magic, TRACE_MAGIC, sizeof ( magic ) ) )
+  {
+    fprintf ( stderr, "%s: not a trace file\n", argv[1] );
+    fclose ( fp );
+    return 1;
+  }
+  map<uint16_t, vector<TTraceRecord> > processes;
+  TTraceRecord buf[4096];
+  size_t n;
+  while ( ( n = fread ( buf, sizeof ( buf[0] ), sizeof ( buf ) / sizeof ( buf[0] ), fp ) ) > 0 )
+    for ( size_t i = 0; i < n; i ++ )
+      processes[buf[i] . m_Process] . push_back ( buf[i] );
+  fclose ( fp );
+
+  for ( const auto & p : processes )
+    analyzeProcess ( p . first, p . second, windowNs );
+  return 0;
+}